@@ -30,6 +30,18 @@ typedef Elf64_Sxword	Elf64_Ssize;
 
 #define EI_NIDENT 16
 
+/* Indexes into the e_ident array. */
+#define EI_CLASS	4	/* Class of machine. */
+#define EI_DATA		5	/* Data format. */
+
+/* Values for the class (EI_CLASS). */
+#define ELFCLASS32	1	/* 32-bit objects. */
+#define ELFCLASS64	2	/* 64-bit objects. */
+
+/* Values for the data format (EI_DATA). */
+#define ELFDATA2LSB	1	/* 2's complement little-endian. */
+#define ELFDATA2MSB	2	/* 2's complement big-endian. */
+
 /*
  * ELF header.
  */
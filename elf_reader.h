@@ -0,0 +1,178 @@
+/*
+ * Symbol table reader specialised at compile time for one ELF class and byte
+ * order. Include it with
+ *	ELFR_BITS	32 or 64
+ *	ELFR_DATA	ELFDATA2LSB or ELFDATA2MSB
+ *	ELFR_PREFIX	prefix of the generated functions, e.g. elf64lsb
+ * defined, after struct symbol_index and read_section(). It defines
+ * <prefix>_load_tables(), which fills a symbol_index with the tables converted
+ * to native Elf64 entries. For the host's own class and byte order every
+ * conversion is the identity and the tables are used as read, so that reader
+ * is the same as accessing the Elf64 structs directly.
+ */
+
+#if ELFR_BITS == 32
+#define ELFR_T(type)	Elf32_##type
+#define ELFR_SWORD	Elf32_Sword
+#define ELFR_R_SYM	ELF32_R_SYM
+#define ELFR_R_TYPE	ELF32_R_TYPE
+#else
+#define ELFR_T(type)	Elf64_##type
+#define ELFR_SWORD	Elf64_Sxword
+#define ELFR_R_SYM	ELF64_R_SYM
+#define ELFR_R_TYPE	ELF64_R_TYPE
+#endif
+
+#if (ELFR_DATA == ELFDATA2LSB) == (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define ELFR_SWAP	0
+#else
+#define ELFR_SWAP	1
+#endif
+#define ELFR_NATIVE	(ELFR_BITS == 64 && !ELFR_SWAP)
+
+/* Signed fields are converted as their unsigned bits, cast back by the caller. */
+#define ELFR_16(x)	((uint16_t)(ELFR_SWAP ? __builtin_bswap16((uint16_t)(x)) : (uint16_t)(x)))
+#define ELFR_32(x)	((uint32_t)(ELFR_SWAP ? __builtin_bswap32((uint32_t)(x)) : (uint32_t)(x)))
+#define ELFR_64(x)	((uint64_t)(ELFR_SWAP ? __builtin_bswap64((uint64_t)(x)) : (uint64_t)(x)))
+#if ELFR_BITS == 32
+#define ELFR_W(x)	ELFR_32(x)	/* Addr, Off and the class sized words. */
+#else
+#define ELFR_W(x)	ELFR_64(x)
+#endif
+
+#define ELFR_NAME2(prefix, name)	prefix##_##name
+#define ELFR_NAME1(prefix, name)	ELFR_NAME2(prefix, name)
+#define ELFR_NAME(name)			ELFR_NAME1(ELFR_PREFIX, name)
+
+// Read a symbol table section as Elf64 symbols
+static Elf64_Sym *ELFR_NAME(read_syms)(FILE *fptr, const Elf64_Shdr *shdr, size_t *count)
+{
+	ELFR_T(Sym) *raw = read_section(fptr, shdr);
+	*count = raw ? shdr->sh_size / sizeof(ELFR_T(Sym)) : 0;
+#if ELFR_NATIVE
+	return raw;
+#else
+	Elf64_Sym *syms = calloc(*count + 1, sizeof(Elf64_Sym));
+	for (size_t i = 0; i < *count; i++)
+	{
+		syms[i].st_name = ELFR_32(raw[i].st_name);
+		syms[i].st_info = raw[i].st_info;
+		syms[i].st_other = raw[i].st_other;
+		syms[i].st_shndx = ELFR_16(raw[i].st_shndx);
+		syms[i].st_value = ELFR_W(raw[i].st_value);
+		syms[i].st_size = ELFR_W(raw[i].st_size);
+	}
+	free(raw);
+	return syms;
+#endif
+}
+
+// Read a .rela.plt (has_addend) or .rel.plt section as Elf64 relocations
+static Elf64_Rela *ELFR_NAME(read_plt_relocs)(FILE *fptr, const Elf64_Shdr *shdr, bool has_addend, size_t *count)
+{
+	size_t entsize = has_addend ? sizeof(ELFR_T(Rela)) : sizeof(ELFR_T(Rel));
+	unsigned char *raw = read_section(fptr, shdr);
+	*count = raw ? shdr->sh_size / entsize : 0;
+#if ELFR_NATIVE
+	if (has_addend)
+		return (Elf64_Rela *)raw;
+#endif
+	Elf64_Rela *relas = calloc(*count + 1, sizeof(Elf64_Rela));
+	for (size_t i = 0; i < *count; i++)
+	{
+		// Rela starts with the fields of Rel
+		ELFR_T(Rela) *rel = (ELFR_T(Rela) *)(raw + i * entsize);
+		uint64_t info = ELFR_W(rel->r_info);
+		relas[i].r_offset = ELFR_W(rel->r_offset);
+		relas[i].r_info = ELF64_R_INFO((uint64_t)ELFR_R_SYM(info), ELFR_R_TYPE(info));
+		relas[i].r_addend = has_addend ? (ELFR_SWORD)ELFR_W(rel->r_addend) : 0;
+	}
+	free(raw);
+	return relas;
+}
+
+// Fill index with the symbol tables of the ELF file at fptr
+static bool ELFR_NAME(load_tables)(FILE *fptr, struct symbol_index *index)
+{
+	ELFR_T(Ehdr) ehdr;
+	fseek(fptr, 0, SEEK_SET);
+	if (fread(&ehdr, sizeof(ehdr), 1, fptr) != 1)
+		return false;
+	index->e_type = ELFR_16(ehdr.e_type);
+	uint16_t shnum = ELFR_16(ehdr.e_shnum);
+	uint16_t shstrndx = ELFR_16(ehdr.e_shstrndx);
+	if (shnum == 0 || shstrndx >= shnum)
+		return false;
+
+	ELFR_T(Shdr) *raw_shdrs = calloc(shnum, sizeof(ELFR_T(Shdr)));
+	fseek(fptr, ELFR_W(ehdr.e_shoff), SEEK_SET);
+	if (fread(raw_shdrs, sizeof(ELFR_T(Shdr)), shnum, fptr) != shnum)
+	{
+		free(raw_shdrs);
+		return false;
+	}
+#if ELFR_NATIVE
+	Elf64_Shdr *shdrs = raw_shdrs;
+#else
+	Elf64_Shdr *shdrs = calloc(shnum, sizeof(Elf64_Shdr));
+	for (int i = 0; i < shnum; i++)
+	{
+		shdrs[i].sh_name = ELFR_32(raw_shdrs[i].sh_name);
+		shdrs[i].sh_type = ELFR_32(raw_shdrs[i].sh_type);
+		shdrs[i].sh_offset = ELFR_W(raw_shdrs[i].sh_offset);
+		shdrs[i].sh_size = ELFR_W(raw_shdrs[i].sh_size);
+		shdrs[i].sh_link = ELFR_32(raw_shdrs[i].sh_link);
+		shdrs[i].sh_entsize = ELFR_W(raw_shdrs[i].sh_entsize);
+	}
+	free(raw_shdrs);
+#endif
+	char *shstrtab_buf = read_section(fptr, &shdrs[shstrndx]);
+
+	Elf64_Shdr *symtab = NULL, *strtab = NULL, *dynsym = NULL, *dynstr = NULL, *rela_plt = NULL, *rel_plt = NULL;
+	for (int i = 0; shstrtab_buf != NULL && i < shnum; i++)
+	{
+		const char *name = shstrtab_buf + shdrs[i].sh_name;
+		if (strcmp(name, ".symtab") == 0)
+			symtab = &shdrs[i];
+		else if (strcmp(name, ".strtab") == 0)
+			strtab = &shdrs[i];
+		else if (strcmp(name, ".dynsym") == 0)
+			dynsym = &shdrs[i];
+		else if (strcmp(name, ".dynstr") == 0)
+			dynstr = &shdrs[i];
+		else if (strcmp(name, ".rela.plt") == 0)
+			rela_plt = &shdrs[i];
+		else if (strcmp(name, ".rel.plt") == 0)
+			rel_plt = &shdrs[i];
+	}
+
+	index->symtab = ELFR_NAME(read_syms)(fptr, symtab, &index->symtab_count);
+	index->strtab = read_section(fptr, strtab);
+	index->dynsym = ELFR_NAME(read_syms)(fptr, dynsym, &index->dynsym_count);
+	index->dynstr = read_section(fptr, dynstr);
+	if (rela_plt != NULL)
+		index->rela_plt = ELFR_NAME(read_plt_relocs)(fptr, rela_plt, true, &index->rela_plt_count);
+	else if (rel_plt != NULL)
+		index->rela_plt = ELFR_NAME(read_plt_relocs)(fptr, rel_plt, false, &index->rela_plt_count);
+
+	free(shstrtab_buf);
+	free(shdrs);
+	return true;
+}
+
+#undef ELFR_T
+#undef ELFR_SWORD
+#undef ELFR_R_SYM
+#undef ELFR_R_TYPE
+#undef ELFR_SWAP
+#undef ELFR_NATIVE
+#undef ELFR_16
+#undef ELFR_32
+#undef ELFR_64
+#undef ELFR_W
+#undef ELFR_NAME2
+#undef ELFR_NAME1
+#undef ELFR_NAME
+#undef ELFR_BITS
+#undef ELFR_DATA
+#undef ELFR_PREFIX
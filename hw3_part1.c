@@ -1,3 +1,4 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -12,8 +13,33 @@
 #include <errno.h>
 #include <string.h>
 #include <stdbool.h>
+#include <ctype.h>
+#include <getopt.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/resource.h>
+#include <limits.h>
+#include <stddef.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/signalfd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
+#include <sys/prctl.h>
+#include <linux/filter.h>
+#include <linux/seccomp.h>
+#include <linux/audit.h>
+#include <linux/perf_event.h>
 
 #include "elf64.h"
+#include "elf32.h"
+#include "prf_audit.h"
 
 #define	ET_NONE	0	//No file type 
 #define	ET_REL	1	//Relocatable file 
@@ -22,78 +48,174 @@
 #define ET_CORE 4	// Core file
 
 #define STB_GLOBAL 1
+#define STT_FUNC 2
 
-/* symbol_name		- The symbol (maybe function) we need to search for.
- * exe_file_name	- The file where we search the symbol in.
- * error_val		- If  1: A global symbol was found, and defined in the given executable.
- * 			- If -1: Symbol not found.
- *			- If -2: Only a local symbol was found.
- * 			- If -3: File is not an executable.
- * return value		- The address which the symbol_name will be loaded to, if the symbol was found and is global.
- */
-unsigned long find_symbol(const char *symbol_name, char *exe_file_name, int *error_val)
+// The symbol tables of an ELF file, loaded once and shared by every lookup.
+// Whatever the file's class and byte order, the tables hold native Elf64 entries.
+struct symbol_index
+{
+	unsigned char elf_class; // 0 if not an ELF file
+	unsigned char elf_data;
+	Elf64_Half e_type;
+	Elf64_Sym *symtab;
+	size_t symtab_count;
+	char *strtab;
+	Elf64_Sym *dynsym;
+	size_t dynsym_count;
+	char *dynstr;
+	Elf64_Rela *rela_plt;
+	size_t rela_plt_count;
+	// identity of the file in the cache
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	struct symbol_index *next;
+};
+
+// read a whole section into a new buffer
+void *read_section(FILE *fptr, const Elf64_Shdr *shdr)
+{
+	if (shdr == NULL || shdr->sh_size == 0)
+		return NULL;
+	void *buf = malloc(shdr->sh_size);
+	fseek(fptr, shdr->sh_offset, SEEK_SET);
+	if (fread(buf, shdr->sh_size, 1, fptr) != 1)
+	{
+		free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+#define ELFR_BITS 64
+#define ELFR_DATA ELFDATA2LSB
+#define ELFR_PREFIX elf64lsb
+#include "elf_reader.h"
+
+#define ELFR_BITS 64
+#define ELFR_DATA ELFDATA2MSB
+#define ELFR_PREFIX elf64msb
+#include "elf_reader.h"
+
+#define ELFR_BITS 32
+#define ELFR_DATA ELFDATA2LSB
+#define ELFR_PREFIX elf32lsb
+#include "elf_reader.h"
+
+#define ELFR_BITS 32
+#define ELFR_DATA ELFDATA2MSB
+#define ELFR_PREFIX elf32msb
+#include "elf_reader.h"
+
+// Load the symbol tables of exe_file_name, NULL if it can't be opened.
+// e_ident picks the reader specialised for the file's class and byte order.
+struct symbol_index *load_symbol_index(const char *exe_file_name)
 {
 	FILE *fptr = fopen(exe_file_name, "r");
 	if (fptr == NULL)
+		return NULL;
+
+	struct symbol_index *index = calloc(1, sizeof(struct symbol_index));
+	struct stat st;
+	fstat(fileno(fptr), &st);
+	index->dev = st.st_dev;
+	index->ino = st.st_ino;
+	index->mtime = st.st_mtim;
+
+	unsigned char ident[EI_NIDENT];
+	if (fread(ident, sizeof(ident), 1, fptr) != 1 || memcmp(ident, "\177ELF", 4) != 0)
 	{
-		*error_val = -3;
-		return 0;
+		fclose(fptr);
+		return index;
 	}
 
-	Elf64_Ehdr ehdr;
-	fread(&ehdr, sizeof(Elf64_Ehdr), 1, fptr);
-
-	if (ehdr.e_type != ET_EXEC)
+	bool loaded = false, known = true;
+	switch (ident[EI_CLASS] << 8 | ident[EI_DATA])
 	{
-		*error_val = -3;
-		return 0;
+	case ELFCLASS64 << 8 | ELFDATA2LSB:
+		loaded = elf64lsb_load_tables(fptr, index);
+		break;
+	case ELFCLASS64 << 8 | ELFDATA2MSB:
+		loaded = elf64msb_load_tables(fptr, index);
+		break;
+	case ELFCLASS32 << 8 | ELFDATA2LSB:
+		loaded = elf32lsb_load_tables(fptr, index);
+		break;
+	case ELFCLASS32 << 8 | ELFDATA2MSB:
+		loaded = elf32msb_load_tables(fptr, index);
+		break;
+	default:
+		known = false;
+		break;
 	}
+	// an ELF file without sections (a core dump) still has its class
+	if (known)
+	{
+		index->elf_class = ident[EI_CLASS];
+		index->elf_data = ident[EI_DATA];
+	}
+	if (!loaded)
+		index->e_type = ET_NONE;
+	if (index->strtab == NULL)
+		index->symtab_count = 0;
+	if (index->dynstr == NULL)
+		index->dynsym_count = 0;
 
-	Elf64_Shdr shdr;
-	fseek(fptr, ehdr.e_shoff, SEEK_SET);
-	fread(&shdr, sizeof(Elf64_Shdr), 1, fptr);
+	fclose(fptr);
+	return index;
+}
 
-	Elf64_Shdr shstrtab;
-	fseek(fptr, ehdr.e_shoff + ehdr.e_shstrndx * sizeof(Elf64_Shdr), SEEK_SET);
-	fread(&shstrtab, sizeof(Elf64_Shdr), 1, fptr);
+static struct symbol_index *symbol_index_cache = NULL;
+static pthread_mutex_t symbol_index_lock = PTHREAD_MUTEX_INITIALIZER;
 
-	char *shstrtab_buf = malloc(shstrtab.sh_size);
-	fseek(fptr, shstrtab.sh_offset, SEEK_SET);
-	fread(shstrtab_buf, shstrtab.sh_size, 1, fptr);
+// Cached load_symbol_index, the file is loaded again only if it changed
+struct symbol_index *get_symbol_index(const char *exe_file_name)
+{
+	struct stat st;
+	if (stat(exe_file_name, &st) < 0)
+		return NULL;
 
-	Elf64_Shdr symtab;
-	Elf64_Shdr strtab;
-	for (int i = 0; i < ehdr.e_shnum; i++)
+	pthread_mutex_lock(&symbol_index_lock);
+	struct symbol_index *index = symbol_index_cache;
+	while (index != NULL && !(index->dev == st.st_dev && index->ino == st.st_ino &&
+							  index->mtime.tv_sec == st.st_mtim.tv_sec && index->mtime.tv_nsec == st.st_mtim.tv_nsec))
+		index = index->next;
+	if (index == NULL)
 	{
-		fseek(fptr, ehdr.e_shoff + i * sizeof(Elf64_Shdr), SEEK_SET);
-		fread(&shdr, sizeof(Elf64_Shdr), 1, fptr);
-
-		if (strcmp(shstrtab_buf + shdr.sh_name, ".symtab") == 0)
-		{
-			symtab = shdr;
-		}
-		else if (strcmp(shstrtab_buf + shdr.sh_name, ".strtab") == 0)
+		index = load_symbol_index(exe_file_name);
+		if (index != NULL)
 		{
-			strtab = shdr;
+			index->next = symbol_index_cache;
+			symbol_index_cache = index;
 		}
 	}
+	pthread_mutex_unlock(&symbol_index_lock);
+	return index;
+}
 
-	Elf64_Sym sym = {0};
-	char *strtab_buf = malloc(strtab.sh_size);
-	fseek(fptr, strtab.sh_offset, SEEK_SET);
-	fread(strtab_buf, strtab.sh_size, 1, fptr);
+// Only the host's own executables can be traced, other classes are for --lookup
+bool symbol_index_traceable(const struct symbol_index *index)
+{
+	return index != NULL && index->e_type == ET_EXEC && index->elf_class == ELFCLASS64 && index->elf_data == ELFDATA2LSB;
+}
 
-	Elf64_Sym symtab_buf[symtab.sh_size / sizeof(Elf64_Sym)];
-	fseek(fptr, symtab.sh_offset, SEEK_SET);
-	fread(symtab_buf, symtab.sh_size, 1, fptr);
-	bool found_global = false;
+// find_symbol on an already loaded index
+unsigned long symbol_index_lookup(const struct symbol_index *index, const char *symbol_name, int *error_val)
+{
+	if (!symbol_index_traceable(index))
+	{
+		*error_val = -3;
+		return 0;
+	}
 
-	for (int i = 0; i < symtab.sh_size / sizeof(Elf64_Sym); i++)
+	Elf64_Sym sym = {0};
+	bool found_global = false;
+	for (size_t i = 0; i < index->symtab_count; i++)
 	{
-		if (strcmp(strtab_buf + symtab_buf[i].st_name, symbol_name) == 0)
+		if (strcmp(index->strtab + index->symtab[i].st_name, symbol_name) == 0)
 		{
-			sym = symtab_buf[i];
-			if (ELF64_ST_BIND(symtab_buf[i].st_info) == STB_GLOBAL)
+			sym = index->symtab[i];
+			if (ELF64_ST_BIND(sym.st_info) == STB_GLOBAL)
 			{
 				found_global = true;
 				break;
@@ -110,103 +232,36 @@ unsigned long find_symbol(const char *symbol_name, char *exe_file_name, int *err
 
 	if (found_global && sym.st_shndx == SHN_UNDEF)
 	{
-		// find the symbol in the dynsym section
-		Elf64_Shdr dynsym;
-		for (int i = 0; i < ehdr.e_shnum; i++)
-		{
-			fseek(fptr, ehdr.e_shoff + i * sizeof(Elf64_Shdr), SEEK_SET);
-			fread(&shdr, sizeof(Elf64_Shdr), 1, fptr);
-
-			if (strcmp(shstrtab_buf + shdr.sh_name, ".dynsym") == 0)
-			{
-				dynsym = shdr;
-				break;
-			}
-		}
-
-		// find dynstr section
-		Elf64_Shdr dynstr;
-		for (int i = 0; i < ehdr.e_shnum; i++)
-		{
-			fseek(fptr, ehdr.e_shoff + i * sizeof(Elf64_Shdr), SEEK_SET);
-			fread(&shdr, sizeof(Elf64_Shdr), 1, fptr);
-
-			if (strcmp(shstrtab_buf + shdr.sh_name, ".dynstr") == 0)
-			{
-				dynstr = shdr;
-				break;
-			}
-		}
-
-		char *dynstr_buf = malloc(dynstr.sh_size);
-		fseek(fptr, dynstr.sh_offset, SEEK_SET);
-		fread(dynstr_buf, dynstr.sh_size, 1, fptr);
-
-		Elf64_Sym dynsym_buf[dynsym.sh_size / sizeof(Elf64_Sym)];
-		fseek(fptr, dynsym.sh_offset, SEEK_SET);
-		fread(dynsym_buf, dynsym.sh_size, 1, fptr);
-		long dynsym_index = 0;
-		for (dynsym_index = 0; dynsym_index < dynsym.sh_size / sizeof(Elf64_Sym); dynsym_index++)
-		{
-			// printf("dynsym name: %s\n", dynstr_buf + dynsym_buf[dynsym_index].st_name);
-			if (strcmp(dynstr_buf + dynsym_buf[dynsym_index].st_name, symbol_name) == 0)
-			{
-				sym = dynsym_buf[dynsym_index];
-				// printf("found in dynsym with index %ld", dynsym_index);
-				break;
-			}
-		}
-
-		// printf("dynsym size: %ld \n", dynsym.sh_size);
-		// find the symbol in the rela.plt section
-		Elf64_Shdr rela_plt;
-		for (int i = 0; i < ehdr.e_shnum; i++)
+		// find the symbol in the dynsym section, then its .got.plt slot in .rela.plt
+		size_t dynsym_index;
+		for (dynsym_index = 0; dynsym_index < index->dynsym_count; dynsym_index++)
 		{
-			fseek(fptr, ehdr.e_shoff + i * sizeof(Elf64_Shdr), SEEK_SET);
-			fread(&shdr, sizeof(Elf64_Shdr), 1, fptr);
-
-			if (strcmp(shstrtab_buf + shdr.sh_name, ".rela.plt") == 0)
-			{
-				rela_plt = shdr;
+			if (strcmp(index->dynstr + index->dynsym[dynsym_index].st_name, symbol_name) == 0)
 				break;
-			}
 		}
 
-		// printf("rela.plt size: %ld \n", rela_plt.sh_size);
-
-		Elf64_Rela rela_plt_buf[rela_plt.sh_size / sizeof(Elf64_Rela)];
-		fseek(fptr, rela_plt.sh_offset, SEEK_SET);
-		fread(rela_plt_buf, rela_plt.sh_size, 1, fptr);
-
-		for (int i = 0; i < rela_plt.sh_size / sizeof(Elf64_Rela); i++)
+		unsigned long got_addr = 0;
+		for (size_t i = 0; dynsym_index < index->dynsym_count && i < index->rela_plt_count; i++)
 		{
-			// find the symbol in the rela.plt section
-			// printf("%d at index %d, comparing to %ld\n", sym.st_name, dynsym_index, ELF64_R_SYM(rela_plt_buf[i].r_info));
-			if (ELF64_R_SYM(rela_plt_buf[i].r_info) == dynsym_index) ///
+			if (ELF64_R_SYM(index->rela_plt[i].r_info) == dynsym_index)
 			{
-				// printf("found in rela.plt \n");
-				sym.st_value = rela_plt_buf[i].r_offset;
+				got_addr = index->rela_plt[i].r_offset;
 				break;
 			}
 		}
 
-		// printf("sym value: %ld \n", sym.st_value);
-
 		// if not found
-		if (sym.st_value == 0)
+		if (got_addr == 0)
 		{
 			*error_val = -1;
 			return 0;
 		}
 
-		// if found return address
-
 		*error_val = 2; // success
-		return sym.st_value;
+		return got_addr;
 	}
 
 	// if local symbol
-	// printf("%d", ELF64_ST_BIND(sym.st_info));
 	if (!found_global)
 	{
 		*error_val = -2;
@@ -217,6 +272,21 @@ unsigned long find_symbol(const char *symbol_name, char *exe_file_name, int *err
 	return sym.st_value;
 }
 
+/* symbol_name		- The symbol (maybe function) we need to search for.
+ * exe_file_name	- The file where we search the symbol in.
+ * error_val		- If  1: A global symbol was found, and defined in the given executable.
+ *			- If  2: A global symbol imported from a shared library was found,
+ *			         the return value is its .got.plt slot.
+ * 			- If -1: Symbol not found.
+ *			- If -2: Only a local symbol was found.
+ * 			- If -3: File is not an executable.
+ * return value		- The address which the symbol_name will be loaded to, if the symbol was found and is global.
+ */
+unsigned long find_symbol(const char *symbol_name, char *exe_file_name, int *error_val)
+{
+	return symbol_index_lookup(get_symbol_index(exe_file_name), symbol_name, error_val);
+}
+
 Elf64_Shdr get_section_header(FILE *fptr, Elf64_Ehdr ehdr, char *section_name)
 {
 	Elf64_Shdr shdr;
@@ -255,6 +325,17 @@ Elf64_Shdr get_section_header(FILE *fptr, Elf64_Ehdr ehdr, char *section_name)
 	return shdr;
 }
 
+// waitpid for a stop or the exit of the tracee pid. The shards get SIGUSR1 to
+// leave their blocking waitpid(-1), this one is restarted instead.
+pid_t wait_tracee(pid_t pid, int *wait_status)
+{
+	pid_t ret;
+	do
+		ret = waitpid(pid, wait_status, __WALL);
+	while (ret < 0 && errno == EINTR);
+	return ret;
+}
+
 // Set breakpoint and return original data
 unsigned long add_breakpoint(unsigned long addr, pid_t pid)
 {
@@ -270,15 +351,23 @@ void remove_breakpoint(unsigned long addr, unsigned long data, pid_t pid)
 	ptrace(PTRACE_POKETEXT, pid, (void *)addr, (void *)data);
 }
 
+double elapsed_us(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e6 + (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
 // continue after breakpoint and return it
 void step_breakpoint(unsigned long addr, unsigned long data, pid_t pid)
 {
+	int wait_status;
 	remove_breakpoint(addr, data, pid);
 	struct user_regs_struct regs;
 	ptrace(PTRACE_GETREGS, pid, NULL, &regs);
 	regs.rip -= 1;
 	ptrace(PTRACE_SETREGS, pid, NULL, &regs);
 	ptrace(PTRACE_SINGLESTEP, pid, NULL, NULL);
+	// the text can only be patched again once the step has finished
+	wait_tracee(pid, &wait_status);
 	add_breakpoint(addr, pid);
 }
 
@@ -292,142 +381,3922 @@ void prf_printf(char *format, ...)
 	va_end(args);
 }
 
-void count_calls(unsigned long addr, pid_t pid, bool dynamic_addr)
+#define METRICS_MAX_FUNCS 64
+#define METRICS_BUCKETS 40 // bucket i counts calls taking [2^i, 2^(i+1)) ns
+
+// per-function counters of the live metrics snapshot
+struct metrics_func
 {
-	int wait_status;
-	wait(&wait_status);
-	if (dynamic_addr)
+	char name[64];
+	long calls;	  // outermost calls, counted at their return under --where
+	long returns; // outermost calls that returned
+	long latency_ns_total;
+	long latency_hist[METRICS_BUCKETS];
+	long ret_min;
+	long ret_max;
+	long ret_sum;
+};
+
+// Live counters in shared memory, published with a seqlock: seq is odd while
+// the tracer writes, readers copy the snapshot and retry until they saw the
+// same even seq before and after the copy
+struct metrics_snapshot
+{
+	unsigned long seq;
+	pid_t tracer_pid;
+	int nfuncs;
+	struct metrics_func funcs[METRICS_MAX_FUNCS];
+};
+
+struct metrics
+{
+	struct metrics_snapshot *snapshot;
+	pthread_mutex_t writer_lock; // between tracer threads only, readers never lock
+	char shm_name[128];
+	char socket_path[sizeof(((struct sockaddr_un *)0)->sun_path)];
+	int listen_fd;
+	pthread_t server;
+	bool stopping; // set before the listening socket is shut down to end the server
+};
+
+void metrics_begin_write(struct metrics *m)
+{
+	pthread_mutex_lock(&m->writer_lock);
+	__atomic_store_n(&m->snapshot->seq, m->snapshot->seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void metrics_end_write(struct metrics *m)
+{
+	__atomic_store_n(&m->snapshot->seq, m->snapshot->seq + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&m->writer_lock);
+}
+
+// Consistent copy of the snapshot, without blocking the tracer
+void metrics_read(const struct metrics_snapshot *snapshot, struct metrics_snapshot *copy)
+{
+	unsigned long seq;
+	do
+	{
+		seq = __atomic_load_n(&snapshot->seq, __ATOMIC_ACQUIRE);
+		memcpy(copy, snapshot, sizeof(*copy));
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while ((seq & 1) || seq != __atomic_load_n(&snapshot->seq, __ATOMIC_RELAXED));
+}
+
+// Index of name in the snapshot, added if it's not there yet. -1 if full.
+int metrics_slot(struct metrics *m, const char *name)
+{
+	struct metrics_snapshot *snapshot = m->snapshot;
+	int slot = -1;
+	metrics_begin_write(m);
+	for (int i = 0; i < snapshot->nfuncs && slot < 0; i++)
+	{
+		if (strcmp(snapshot->funcs[i].name, name) == 0)
+			slot = i;
+	}
+	if (slot < 0 && snapshot->nfuncs < METRICS_MAX_FUNCS)
 	{
-		addr = ptrace(PTRACE_PEEKTEXT, pid, (void *)addr, NULL);
+		slot = snapshot->nfuncs++;
+		strncpy(snapshot->funcs[slot].name, name, sizeof(snapshot->funcs[slot].name) - 1);
 	}
+	metrics_end_write(m);
+	return slot;
+}
 
-	// set breakpoint at addr
-	unsigned long func_ep_data = add_breakpoint(addr, pid);
-	struct user_regs_struct regs;
-	// printf("addr: %lx", addr);
+void metrics_on_entry(struct metrics *m, int slot)
+{
+	metrics_begin_write(m);
+	m->snapshot->funcs[slot].calls++;
+	metrics_end_write(m);
+}
 
-	unsigned long ret_addr = 0;
-	unsigned long ret_addr_data = 0;
+void metrics_on_return(struct metrics *m, int slot, long latency_ns, long ret)
+{
+	struct metrics_func *f = &m->snapshot->funcs[slot];
+	int bucket = 63 - __builtin_clzl(latency_ns | 1);
+	metrics_begin_write(m);
+	if (f->returns == 0 || ret < f->ret_min)
+		f->ret_min = ret;
+	if (f->returns == 0 || ret > f->ret_max)
+		f->ret_max = ret;
+	f->returns++;
+	f->ret_sum += ret;
+	f->latency_ns_total += latency_ns;
+	f->latency_hist[bucket < METRICS_BUCKETS ? bucket : METRICS_BUCKETS - 1]++;
+	metrics_end_write(m);
+}
 
-	long inner_calls = 0;
-	bool in_func = false;
-	int call_counter = 0;
-	while (WIFSTOPPED(wait_status))
+void metrics_write_json(FILE *out, const struct metrics_snapshot *snapshot)
+{
+	fprintf(out, "{\"tracer_pid\": %d, \"functions\": [", snapshot->tracer_pid);
+	for (int i = 0; i < snapshot->nfuncs; i++)
 	{
-		if (true)
-		{
-			printf("Looking for addrs: %lx, %lx \n", addr, ret_addr);
-			// check if breakpoint is at addr
-			ptrace(PTRACE_GETREGS, pid, NULL, &regs); // get the registers
-			// printf("Current addrs: %lx, in function: %d\n", regs.rip - 1, in_func);
-			if (regs.rip - 1 == addr)
-			{
-				// printf("in function\n");
-				in_func = true;
-				inner_calls++;
-				// get return address from stack
-				ret_addr = ptrace(PTRACE_PEEKDATA, pid, (void *)(regs.rsp), NULL);
-				// set breakpoint at return address
-				ret_addr_data = add_breakpoint(ret_addr, pid);
-				// continue
-				step_breakpoint(addr, func_ep_data, pid);
-				// add_breakpoint(addr, pid);
-				// remove_breakpoint(addr, func_ep_data, pid);
-			}
-			// if breakpoint is at return address
-			else if (regs.rip - 1 == ret_addr)
-			{
-				// printf("return address: %lx \n", ret_addr);
-				inner_calls--;
-				in_func = false;
-				if (inner_calls == 0)
-				{
-					// remove_breakpoint(ret_addr, ret_addr_data, pid);
-					// regs.rip -= 1;
-					// ptrace(PTRACE_SETREGS, pid, NULL, &regs);
-					// add_breakpoint(addr, pid);
-				}
-				else
-				{
-				}
-				// print return value
-				call_counter++;
-				int ret_val = regs.rax;
-				prf_printf("run %ld returned with %d\n", call_counter, ret_val);
-				step_breakpoint(ret_addr, ret_addr_data, pid);
-				// remove_breakpoint(ret_addr, ret_addr_data, pid);
-			}
-		}
-		else
+		const struct metrics_func *f = &snapshot->funcs[i];
+		fprintf(out, "%s\n  {\"name\": \"%s\", \"calls\": %ld, \"returns\": %ld, \"latency_ns_total\": %ld, "
+					 "\"ret_min\": %ld, \"ret_max\": %ld, \"ret_sum\": %ld, \"latency_hist_log2_ns\": [",
+				i ? "," : "", f->name, f->calls, f->returns, f->latency_ns_total, f->ret_min, f->ret_max, f->ret_sum);
+		for (int b = 0; b < METRICS_BUCKETS; b++)
+			fprintf(out, "%s%ld", b ? ", " : "", f->latency_hist[b]);
+		fprintf(out, "]}");
+	}
+	fprintf(out, "\n]}\n");
+}
+
+// Answer every connection to the socket with the current snapshot as JSON
+void *metrics_server(void *arg)
+{
+	struct metrics *m = arg;
+	struct metrics_snapshot *copy = malloc(sizeof(struct metrics_snapshot));
+	while (true)
+	{
+		int fd = accept(m->listen_fd, NULL, NULL);
+		if (__atomic_load_n(&m->stopping, __ATOMIC_ACQUIRE))
 		{
-			// printf("in_else line 202\n");
-			// printf("rip: %lx \n", regs.rip);
+			if (fd >= 0)
+				close(fd);
+			break;
 		}
-		ptrace(PTRACE_CONT, pid, NULL, NULL);
-		wait(&wait_status);
+		if (fd < 0 && errno == EINTR)
+			continue;
+		if (fd < 0)
+			break;
+		metrics_read(m->snapshot, copy);
+		FILE *out = fdopen(fd, "w");
+		metrics_write_json(out, copy);
+		fclose(out);
 	}
+	free(copy);
+	return NULL;
 }
 
-pid_t run_target(const char *program_name, char *const args[])
+// Create the /dev/shm/prf-<name> snapshot and serve it on /tmp/prf-<name>.sock
+int metrics_open(struct metrics *m, const char *name)
 {
-	pid_t pid = fork();
-	if (pid > 0)
+	memset(m, 0, sizeof(*m));
+	pthread_mutex_init(&m->writer_lock, NULL);
+	struct sockaddr_un addr = {.sun_family = AF_UNIX};
+	if (snprintf(m->shm_name, sizeof(m->shm_name), "/prf-%s", name) >= (int)sizeof(m->shm_name) ||
+		snprintf(addr.sun_path, sizeof(addr.sun_path), "/tmp/prf-%s.sock", name) >= (int)sizeof(addr.sun_path))
 	{
-		// printf("RUNNING program %s on new process %d\n", program_name, pid);
-		return pid;
+		prf_printf("metrics name %s is too long\n", name);
+		return -1;
 	}
+	memcpy(m->socket_path, addr.sun_path, sizeof(m->socket_path));
 
-	else if (pid == 0)
+	// a new segment, readers still mapping a stale one keep theirs intact
+	shm_unlink(m->shm_name);
+	int shm_fd = shm_open(m->shm_name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (shm_fd < 0 || ftruncate(shm_fd, sizeof(struct metrics_snapshot)) < 0)
 	{
-		if(ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0)
-		{
-			perror("ptrace");
-			return -1;
-		}
-		// printf("running program %s on new process %d\n", program_name, pid);
-		execl(program_name, program_name, args + 2, NULL);
-		return 0;
+		perror("shm_open");
+		return -1;
 	}
-	else
+	m->snapshot = mmap(NULL, sizeof(struct metrics_snapshot), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+	close(shm_fd);
+	if (m->snapshot == MAP_FAILED)
 	{
-		perror("fork");
-		// printf("pid < 0 line 237 \n");
+		perror("mmap");
+		return -1;
+	}
+	m->snapshot->tracer_pid = getpid();
+
+	unlink(m->socket_path);
+	m->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m->listen_fd < 0 || bind(m->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(m->listen_fd, 16) < 0)
+	{
+		perror(m->socket_path);
 		return -1;
 	}
+	pthread_create(&m->server, NULL, metrics_server, m);
+	return 0;
 }
 
-int main(int argc, char *const argv[])
+void metrics_close(struct metrics *m)
 {
-	int err = 0;
-	unsigned long addr = find_symbol(argv[1], argv[2], &err);
-	// printf("addr: %lx \n", addr);
-	if (err > 0)
-		// prf_printf("%s will be loaded to 0x%lx\n", argv[1], addr);
-		(void)0;
-	else if (err == -2)
-		prf_printf("%s is not a global symbol! :(\n", argv[1]);
-	else if (err == -1)
-		prf_printf("%s not found!\n", argv[1]);
-	else if (err == -3)
-		prf_printf("%s not an executable! :(\n", argv[2]);
-	else if (err == -4)
-		prf_printf("%s is a global symbol, but will come from a shared library with address %lx\n", argv[1], addr);
+	// wakes the accept, the server finishes the connection it is answering
+	__atomic_store_n(&m->stopping, true, __ATOMIC_RELEASE);
+	shutdown(m->listen_fd, SHUT_RDWR);
+	pthread_join(m->server, NULL);
+	close(m->listen_fd);
+	unlink(m->socket_path);
+	munmap(m->snapshot, sizeof(struct metrics_snapshot));
+	shm_unlink(m->shm_name);
+}
 
-	pid_t pid = run_target(argv[2], argv);
-	if (pid < 0)
+#define STACK_MAX_DEPTH 64
+#define STACK_WINDOW_PAGES 16		 // stack read per capture, from rsp up
+#define STACK_MAX_NODES (1 << 16)	 // trie nodes, new stacks are cut short once it's full
+#define STACK_SLOTS (2 * STACK_MAX_NODES)
+
+// DWARF numbers of the x86-64 registers used by the unwinder
+#define DW_REG_RBP 6
+#define DW_REG_RSP 7
+
+// How to find the caller's frame from a range of pcs, compiled from .eh_frame.
+// A row holds from its pc up to the next row.
+struct unwind_row
+{
+	unsigned long pc;
+	int cfa_reg;	 // DW_REG_RSP or DW_REG_RBP, -1 if the CFA isn't one of them + offset
+	long cfa_offset;
+	long rbp_offset; // rbp is saved at CFA + rbp_offset, 0 if it wasn't saved
+};
+
+struct stack_func
+{
+	unsigned long addr;
+	unsigned long size;
+	const char *name;
+};
+
+// The unwind table and function symbols of one executable
+struct unwind_info
+{
+	const struct symbol_index *index; // identity of the file in the cache
+	struct unwind_row *rows;		  // sorted by pc
+	size_t nrows;
+	struct stack_func *funcs; // sorted by addr
+	size_t nfuncs;
+	struct unwind_info *next;
+};
+
+unsigned long read_uleb128(const unsigned char **p, const unsigned char *end)
+{
+	unsigned long value = 0;
+	for (int shift = 0; *p < end; shift += 7)
 	{
-		// printf("Error running target program\n");
-		perror("fork");
-		return -1;
+		unsigned char byte = *(*p)++;
+		if (shift < 64)
+			value |= (unsigned long)(byte & 0x7f) << shift;
+		if (!(byte & 0x80))
+			break;
 	}
-	if (pid > 0)
+	return value;
+}
+
+long read_sleb128(const unsigned char **p, const unsigned char *end)
+{
+	long value = 0;
+	int shift = 0;
+	unsigned char byte = 0;
+	while (*p < end)
 	{
-		count_calls(addr, pid, err == 2);
+		byte = *(*p)++;
+		if (shift < 64)
+			value |= (long)(byte & 0x7f) << shift;
+		shift += 7;
+		if (!(byte & 0x80))
+			break;
 	}
-	else
+	if (shift < 64 && (byte & 0x40))
+		value |= (long)(~0UL << shift);
+	return value;
+}
+
+// Read a DW_EH_PE_* encoded pointer at *p, which is loaded at vaddr
+unsigned long read_eh_pointer(const unsigned char **p, const unsigned char *end, unsigned char enc, unsigned long vaddr)
+{
+	unsigned long value = 0;
+	if (enc == 0xff) // DW_EH_PE_omit
+		return 0;
+	switch (enc & 0x0f)
 	{
-		// printf("Error running target program\n");
-		perror("fork");
-		return -1;
+	case 0x00: // absptr
+	case 0x04: // udata8
+	case 0x0c: // sdata8
+		if (end - *p >= 8)
+			memcpy(&value, *p, 8);
+		*p += 8;
+		break;
+	case 0x01: // uleb128
+		value = read_uleb128(p, end);
+		break;
+	case 0x09: // sleb128
+		value = (unsigned long)read_sleb128(p, end);
+		break;
+	case 0x02: // udata2
+	case 0x0a: // sdata2
+	{
+		uint16_t v = 0;
+		if (end - *p >= 2)
+			memcpy(&v, *p, 2);
+		value = (enc & 0x08) ? (unsigned long)(long)(int16_t)v : v;
+		*p += 2;
+		break;
+	}
+	case 0x03: // udata4
+	case 0x0b: // sdata4
+	{
+		uint32_t v = 0;
+		if (end - *p >= 4)
+			memcpy(&v, *p, 4);
+		value = (enc & 0x08) ? (unsigned long)(long)(int32_t)v : v;
+		*p += 4;
+		break;
+	}
+	}
+	if ((enc & 0x70) == 0x10) // pcrel
+		value += vaddr;
+	return value;
+}
+
+// CFA rule while running the call frame instructions of an FDE
+struct cfa_state
+{
+	int cfa_reg;
+	long cfa_offset;
+	long rbp_offset;
+};
+
+// The CIE fields the FDEs need
+struct cie_info
+{
+	unsigned long code_align;
+	long data_align;
+	unsigned char fde_enc;
+	bool has_aug_data;
+	const unsigned char *insns;
+	const unsigned char *insns_end;
+};
+
+void unwind_push_row(struct unwind_row **rows, size_t *nrows, size_t *cap, unsigned long pc, const struct cfa_state *state)
+{
+	if (*nrows == *cap)
+	{
+		*cap = *cap ? *cap * 2 : 1024;
+		*rows = realloc(*rows, *cap * sizeof(struct unwind_row));
 	}
-}
\ No newline at end of file
+	struct unwind_row *row = &(*rows)[(*nrows)++];
+	row->pc = pc;
+	row->cfa_reg = state->cfa_reg;
+	row->cfa_offset = state->cfa_offset;
+	row->rbp_offset = state->rbp_offset;
+}
+
+// Run call frame instructions from p to end, pushing a row each time the
+// location advances (when pc isn't NULL, i.e. for the FDE's instructions).
+// Returns false on an instruction it can't follow.
+bool unwind_run_cfa(const unsigned char *p, const unsigned char *end, const struct cie_info *cie, const struct cfa_state *initial,
+					struct cfa_state *state, unsigned long *pc, unsigned long vaddr_delta,
+					struct unwind_row **rows, size_t *nrows, size_t *cap)
+{
+	struct cfa_state saved[8];
+	int nsaved = 0;
+	while (p < end)
+	{
+		unsigned char op = *p++;
+		unsigned long advance = 0;
+		unsigned long reg = 0;
+		long offset = 0;
+		bool is_offset = false;
+		switch (op & 0xc0)
+		{
+		case 0x40: // DW_CFA_advance_loc
+			advance = op & 0x3f;
+			break;
+		case 0x80: // DW_CFA_offset
+			reg = op & 0x3f;
+			offset = (long)read_uleb128(&p, end) * cie->data_align;
+			is_offset = true;
+			break;
+		case 0xc0: // DW_CFA_restore
+			if ((op & 0x3f) == DW_REG_RBP)
+				state->rbp_offset = initial->rbp_offset;
+			break;
+		default:
+			switch (op)
+			{
+			case 0x00: // nop
+				break;
+			case 0x02: // advance_loc1
+				advance = p < end ? *p : 0;
+				p += 1;
+				break;
+			case 0x03: // advance_loc2
+			{
+				uint16_t v = 0;
+				if (end - p >= 2)
+					memcpy(&v, p, 2);
+				advance = v;
+				p += 2;
+				break;
+			}
+			case 0x04: // advance_loc4
+			{
+				uint32_t v = 0;
+				if (end - p >= 4)
+					memcpy(&v, p, 4);
+				advance = v;
+				p += 4;
+				break;
+			}
+			case 0x05: // offset_extended
+				reg = read_uleb128(&p, end);
+				offset = (long)read_uleb128(&p, end) * cie->data_align;
+				is_offset = true;
+				break;
+			case 0x11: // offset_extended_sf
+				reg = read_uleb128(&p, end);
+				offset = read_sleb128(&p, end) * cie->data_align;
+				is_offset = true;
+				break;
+			case 0x06: // restore_extended
+				if (read_uleb128(&p, end) == DW_REG_RBP)
+					state->rbp_offset = initial->rbp_offset;
+				break;
+			case 0x07: // undefined
+			case 0x08: // same_value
+				if (read_uleb128(&p, end) == DW_REG_RBP)
+					state->rbp_offset = 0;
+				break;
+			case 0x09: // register
+			case 0x14: // val_offset
+			case 0x2f: // GNU_negative_offset_extended
+				if (read_uleb128(&p, end) == DW_REG_RBP)
+					state->rbp_offset = 0;
+				read_uleb128(&p, end);
+				break;
+			case 0x15: // val_offset_sf
+				if (read_uleb128(&p, end) == DW_REG_RBP)
+					state->rbp_offset = 0;
+				read_sleb128(&p, end);
+				break;
+			case 0x0a: // remember_state
+				if (nsaved < 8)
+					saved[nsaved++] = *state;
+				break;
+			case 0x0b: // restore_state
+				if (nsaved > 0)
+					*state = saved[--nsaved];
+				break;
+			case 0x0c: // def_cfa
+				reg = read_uleb128(&p, end);
+				state->cfa_reg = reg == DW_REG_RSP || reg == DW_REG_RBP ? (int)reg : -1;
+				state->cfa_offset = (long)read_uleb128(&p, end);
+				break;
+			case 0x12: // def_cfa_sf
+				reg = read_uleb128(&p, end);
+				state->cfa_reg = reg == DW_REG_RSP || reg == DW_REG_RBP ? (int)reg : -1;
+				state->cfa_offset = read_sleb128(&p, end) * cie->data_align;
+				break;
+			case 0x0d: // def_cfa_register
+				reg = read_uleb128(&p, end);
+				state->cfa_reg = reg == DW_REG_RSP || reg == DW_REG_RBP ? (int)reg : -1;
+				break;
+			case 0x0e: // def_cfa_offset
+				state->cfa_offset = (long)read_uleb128(&p, end);
+				break;
+			case 0x13: // def_cfa_offset_sf
+				state->cfa_offset = read_sleb128(&p, end) * cie->data_align;
+				break;
+			case 0x0f: // def_cfa_expression
+				state->cfa_reg = -1;
+				p += read_uleb128(&p, end);
+				break;
+			case 0x10: // expression
+			case 0x16: // val_expression
+				if (read_uleb128(&p, end) == DW_REG_RBP)
+					state->rbp_offset = 0;
+				p += read_uleb128(&p, end);
+				break;
+			case 0x2e: // GNU_args_size
+				read_uleb128(&p, end);
+				break;
+			case 0x01: // set_loc
+			{
+				unsigned long loc = read_eh_pointer(&p, end, cie->fde_enc, (unsigned long)p + vaddr_delta);
+				if (pc != NULL && loc > *pc)
+					advance = (loc - *pc) / cie->code_align;
+				break;
+			}
+			default:
+				return false;
+			}
+		}
+		if (is_offset && reg == DW_REG_RBP)
+			state->rbp_offset = offset;
+		if (advance != 0 && pc != NULL)
+		{
+			unwind_push_row(rows, nrows, cap, *pc, state);
+			*pc += advance * cie->code_align;
+		}
+	}
+	return true;
+}
+
+int unwind_row_cmp(const void *a, const void *b)
+{
+	const struct unwind_row *ra = a, *rb = b;
+	if (ra->pc != rb->pc)
+		return ra->pc < rb->pc ? -1 : 1;
+	// the end of an FDE first, a row starting at the same pc overrides it
+	return ra->cfa_reg - rb->cfa_reg;
+}
+
+int stack_func_cmp(const void *a, const void *b)
+{
+	unsigned long addr_a = ((const struct stack_func *)a)->addr;
+	unsigned long addr_b = ((const struct stack_func *)b)->addr;
+	return addr_a < addr_b ? -1 : addr_a > addr_b;
+}
+
+// Compile the .eh_frame of exe_file_name (a 64-bit little endian ELF) into
+// rows sorted by pc. FDEs end with a row of cfa_reg -1.
+void unwind_load_eh_frame(const char *exe_file_name, struct unwind_info *info)
+{
+	FILE *fptr = fopen(exe_file_name, "r");
+	if (fptr == NULL)
+		return;
+	Elf64_Ehdr ehdr;
+	if (fread(&ehdr, sizeof(ehdr), 1, fptr) != 1 || ehdr.e_ident[EI_CLASS] != ELFCLASS64 || ehdr.e_ident[EI_DATA] != ELFDATA2LSB)
+	{
+		fclose(fptr);
+		return;
+	}
+	Elf64_Shdr *shdrs = calloc(ehdr.e_shnum, sizeof(Elf64_Shdr));
+	fseek(fptr, ehdr.e_shoff, SEEK_SET);
+	if (fread(shdrs, sizeof(Elf64_Shdr), ehdr.e_shnum, fptr) != ehdr.e_shnum || ehdr.e_shstrndx >= ehdr.e_shnum)
+	{
+		free(shdrs);
+		fclose(fptr);
+		return;
+	}
+	char *shstrtab = read_section(fptr, &shdrs[ehdr.e_shstrndx]);
+	const Elf64_Shdr *eh_frame = NULL;
+	for (int i = 0; i < ehdr.e_shnum && shstrtab != NULL; i++)
+	{
+		if (shdrs[i].sh_name < shdrs[ehdr.e_shstrndx].sh_size && strcmp(shstrtab + shdrs[i].sh_name, ".eh_frame") == 0)
+			eh_frame = &shdrs[i];
+	}
+	unsigned char *data = read_section(fptr, eh_frame);
+	fclose(fptr);
+	if (data == NULL)
+	{
+		free(shstrtab);
+		free(shdrs);
+		return;
+	}
+	// pointers in the section are relative to where it is loaded
+	unsigned long vaddr_delta = eh_frame->sh_addr - (unsigned long)data;
+	const unsigned char *section_end = data + eh_frame->sh_size;
+
+	struct unwind_row *rows = NULL;
+	size_t nrows = 0, cap = 0;
+	const unsigned char *p = data;
+	while (section_end - p >= 4)
+	{
+		uint32_t length;
+		memcpy(&length, p, 4);
+		if (length == 0) // terminator
+			break;
+		if (length == 0xffffffff || (size_t)(section_end - p - 4) < length)
+			break; // 64-bit DWARF isn't used in .eh_frame
+		const unsigned char *entry = p + 4;
+		const unsigned char *entry_end = entry + length;
+		p = entry_end;
+		uint32_t cie_ptr;
+		memcpy(&cie_ptr, entry, 4);
+		if (cie_ptr == 0) // a CIE, read from its FDEs
+			continue;
+
+		// the CIE of this FDE, cie_ptr is relative to the field
+		const unsigned char *c = entry - cie_ptr;
+		if (c < data || section_end - c < 8)
+			continue;
+		uint32_t cie_length;
+		memcpy(&cie_length, c, 4);
+		const unsigned char *cie_end = c + 4 + cie_length;
+		if (cie_end > section_end)
+			continue;
+		c += 8; // length and CIE id
+		unsigned char version = *c++;
+		const char *aug = (const char *)c;
+		c += strnlen(aug, cie_end - c) + 1;
+		struct cie_info cie = {.fde_enc = 0};
+		cie.code_align = read_uleb128(&c, cie_end);
+		cie.data_align = read_sleb128(&c, cie_end);
+		if (version == 1)
+			c++;
+		else
+			read_uleb128(&c, cie_end);
+		if (aug[0] == 'z')
+		{
+			unsigned long aug_len = read_uleb128(&c, cie_end);
+			const unsigned char *aug_end = c + aug_len;
+			cie.has_aug_data = true;
+			for (const char *a = aug + 1; *a != '\0' && c < aug_end; a++)
+			{
+				if (*a == 'R')
+					cie.fde_enc = *c++;
+				else if (*a == 'L')
+					c++;
+				else if (*a == 'P')
+				{
+					unsigned char enc = *c++;
+					read_eh_pointer(&c, aug_end, enc & 0x7f, (unsigned long)c + vaddr_delta);
+				}
+			}
+			c = aug_end;
+		}
+		else if (aug[0] != '\0')
+		{
+			continue; // an augmentation we can't skip
+		}
+		cie.insns = c;
+		cie.insns_end = cie_end;
+
+		// the FDE
+		const unsigned char *f = entry + 4;
+		unsigned long pc_begin = read_eh_pointer(&f, entry_end, cie.fde_enc, (unsigned long)f + vaddr_delta);
+		unsigned long pc_range = read_eh_pointer(&f, entry_end, cie.fde_enc & 0x0f, 0);
+		if (cie.has_aug_data)
+			f += read_uleb128(&f, entry_end);
+		if (pc_begin == 0 || cie.code_align == 0)
+			continue;
+
+		struct cfa_state initial = {.cfa_reg = -1};
+		unwind_run_cfa(cie.insns, cie.insns_end, &cie, &initial, &initial, NULL, vaddr_delta, NULL, NULL, NULL);
+		struct cfa_state state = initial;
+		unsigned long pc = pc_begin;
+		struct cfa_state none = {.cfa_reg = -1};
+		bool ok = unwind_run_cfa(f, entry_end, &cie, &initial, &state, &pc, vaddr_delta, &rows, &nrows, &cap);
+		if (pc < pc_begin + pc_range)
+			unwind_push_row(&rows, &nrows, &cap, pc, ok ? &state : &none);
+		unwind_push_row(&rows, &nrows, &cap, pc_begin + pc_range, &none);
+	}
+	qsort(rows, nrows, sizeof(struct unwind_row), unwind_row_cmp);
+	info->rows = rows;
+	info->nrows = nrows;
+	free(data);
+	free(shstrtab);
+	free(shdrs);
+}
+
+static struct unwind_info *unwind_info_cache = NULL;
+static pthread_mutex_t unwind_info_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// The unwind table and function symbols of exe_file_name, built once per file
+const struct unwind_info *get_unwind_info(const char *exe_file_name)
+{
+	const struct symbol_index *index = get_symbol_index(exe_file_name);
+	pthread_mutex_lock(&unwind_info_lock);
+	struct unwind_info *info = unwind_info_cache;
+	while (info != NULL && info->index != index)
+		info = info->next;
+	if (info == NULL)
+	{
+		info = calloc(1, sizeof(struct unwind_info));
+		info->index = index;
+		unwind_load_eh_frame(exe_file_name, info);
+		if (index != NULL)
+		{
+			info->funcs = calloc(index->symtab_count + 1, sizeof(struct stack_func));
+			for (size_t i = 0; i < index->symtab_count; i++)
+			{
+				const Elf64_Sym *sym = &index->symtab[i];
+				if (ELF64_ST_TYPE(sym->st_info) == STT_FUNC && sym->st_shndx != SHN_UNDEF && sym->st_value != 0)
+				{
+					struct stack_func *func = &info->funcs[info->nfuncs++];
+					func->addr = sym->st_value;
+					func->size = sym->st_size;
+					func->name = index->strtab + sym->st_name;
+				}
+			}
+			qsort(info->funcs, info->nfuncs, sizeof(struct stack_func), stack_func_cmp);
+		}
+		info->next = unwind_info_cache;
+		unwind_info_cache = info;
+	}
+	pthread_mutex_unlock(&unwind_info_lock);
+	return info;
+}
+
+// The row covering pc, NULL if there's none or it can't be followed
+const struct unwind_row *unwind_find_row(const struct unwind_info *info, unsigned long pc)
+{
+	size_t lo = 0, hi = info->nrows;
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		if (info->rows[mid].pc <= pc)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0 || info->rows[lo - 1].cfa_reg < 0)
+		return NULL;
+	return &info->rows[lo - 1];
+}
+
+// The function holding pc, NULL if it isn't in the executable
+const struct stack_func *unwind_find_func(const struct unwind_info *info, unsigned long pc)
+{
+	size_t lo = 0, hi = info->nfuncs;
+	while (lo < hi)
+	{
+		size_t mid = (lo + hi) / 2;
+		if (info->funcs[mid].addr <= pc)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == 0)
+		return NULL;
+	const struct stack_func *func = &info->funcs[lo - 1];
+	if (pc >= func->addr + func->size && !(func->size == 0 && lo < info->nfuncs))
+		return NULL;
+	return func;
+}
+
+// Name of the function holding pc, NULL if it isn't in the executable
+const char *unwind_func_name(const struct unwind_info *info, unsigned long pc)
+{
+	const struct stack_func *func = unwind_find_func(info, pc);
+	return func ? func->name : NULL;
+}
+
+// One frame of a captured stack. The trie node's parent is its caller.
+struct stack_node
+{
+	int parent; // -1 for outermost frames
+	const char *name; // NULL for frames outside the executable's functions
+	long samples;	  // stacks ending in this frame
+};
+
+// Captured stacks, hash-consed so every distinct call path is kept once
+struct stack_trie
+{
+	pthread_mutex_t lock;
+	struct stack_node *nodes;
+	int nnodes;
+	int *slots; // open addressing table of node indices by (parent, name), -1 if free
+	long captured;
+	long truncated; // stacks cut short as the trie was full
+};
+
+void stack_trie_init(struct stack_trie *trie)
+{
+	pthread_mutex_init(&trie->lock, NULL);
+	trie->nodes = calloc(STACK_MAX_NODES, sizeof(struct stack_node));
+	trie->slots = malloc(STACK_SLOTS * sizeof(int));
+	memset(trie->slots, 0xff, STACK_SLOTS * sizeof(int));
+}
+
+// The node of name called from parent, created if needed; -1 if the trie is full
+int stack_trie_intern(struct stack_trie *trie, int parent, const char *name)
+{
+	unsigned long hash = 14695981039346656037UL ^ (unsigned)parent;
+	for (const char *c = name ? name : ""; *c != '\0'; c++)
+		hash = (hash ^ (unsigned char)*c) * 1099511628211UL;
+	for (unsigned long i = hash;; i++)
+	{
+		int *slot = &trie->slots[i & (STACK_SLOTS - 1)];
+		if (*slot < 0)
+		{
+			if (trie->nnodes == STACK_MAX_NODES)
+				return -1;
+			*slot = trie->nnodes++;
+			trie->nodes[*slot].parent = parent;
+			trie->nodes[*slot].name = name;
+			return *slot;
+		}
+		struct stack_node *node = &trie->nodes[*slot];
+		if (node->parent == parent && (node->name == name || (node->name && name && strcmp(node->name, name) == 0)))
+			return *slot;
+	}
+}
+
+// A word of the stack copy buf, which starts at sp and holds len bytes
+bool stack_word(const unsigned char *buf, size_t len, unsigned long sp, unsigned long addr, unsigned long *word)
+{
+	if (addr < sp || addr + 8 > sp + len)
+		return false;
+	memcpy(word, buf + (addr - sp), 8);
+	return true;
+}
+
+// Unwind the stack of pid, stopped at the entry of the function func (so its
+// frame isn't set up yet), and count it in the trie. The stack is read with one
+// process_vm_readv. Frames are followed with the .eh_frame rows of the
+// executable and with the frame pointer where there are none.
+void stack_capture(struct stack_trie *trie, const struct unwind_info *info, pid_t pid, const char *func, const struct user_regs_struct *regs)
+{
+	static __thread unsigned char buf[STACK_WINDOW_PAGES * PAGE_SIZE];
+	// one iovec per page, a read stops at the first one that isn't mapped
+	struct iovec local = {buf, sizeof(buf)};
+	struct iovec remote[STACK_WINDOW_PAGES + 1];
+	unsigned long base = regs->rsp;
+	unsigned long addr = base;
+	int niov = 0;
+	while (addr + PAGE_SIZE <= base + sizeof(buf))
+	{
+		unsigned long next = (addr & PAGE_MASK) + PAGE_SIZE;
+		remote[niov].iov_base = (void *)addr;
+		remote[niov].iov_len = next - addr;
+		niov++;
+		addr = next;
+	}
+	ssize_t len = process_vm_readv(pid, &local, 1, remote, niov, 0);
+	if (len < 0)
+		len = 0;
+
+	const char *names[STACK_MAX_DEPTH];
+	int depth = 0;
+	names[depth++] = func;
+	// at the entry the return address is on top of the stack
+	unsigned long sp = base, cfa = base + 8, fp = regs->rbp, ra;
+	while (depth < STACK_MAX_DEPTH && stack_word(buf, len, base, cfa - 8, &ra) && ra != 0)
+	{
+		names[depth++] = unwind_func_name(info, ra - 1);
+		sp = cfa;
+		const struct unwind_row *row = unwind_find_row(info, ra - 1);
+		if (row != NULL)
+		{
+			cfa = (row->cfa_reg == DW_REG_RSP ? sp : fp) + row->cfa_offset;
+			if (row->rbp_offset != 0 && !stack_word(buf, len, base, cfa + row->rbp_offset, &fp))
+				break;
+		}
+		else
+		{
+			// frame pointer chain, which must go up the stack
+			unsigned long saved_fp;
+			if (fp < sp || !stack_word(buf, len, base, fp, &saved_fp))
+				break;
+			cfa = fp + 16;
+			fp = saved_fp;
+		}
+		if (cfa <= sp)
+			break;
+	}
+
+	pthread_mutex_lock(&trie->lock);
+	int node = -1;
+	bool truncated = false;
+	for (int i = depth - 1; i >= 0; i--)
+	{
+		int child = stack_trie_intern(trie, node, names[i]);
+		if (child < 0)
+		{
+			truncated = true;
+			break;
+		}
+		node = child;
+	}
+	if (node >= 0)
+		trie->nodes[node].samples++;
+	trie->captured++;
+	trie->truncated += truncated;
+	pthread_mutex_unlock(&trie->lock);
+}
+
+// Write the stacks as folded lines, outermost frame first, for flamegraph.pl
+int stack_trie_write(struct stack_trie *trie, const char *out_file)
+{
+	FILE *out = fopen(out_file, "w");
+	if (out == NULL)
+	{
+		perror("fopen");
+		return -1;
+	}
+	const char *path[STACK_MAX_DEPTH];
+	for (int i = 0; i < trie->nnodes; i++)
+	{
+		if (trie->nodes[i].samples == 0)
+			continue;
+		int depth = 0;
+		for (int n = i; n >= 0 && depth < STACK_MAX_DEPTH; n = trie->nodes[n].parent)
+			path[depth++] = trie->nodes[n].name;
+		for (int d = depth - 1; d >= 0; d--)
+			fprintf(out, "%s%s", path[d] ? path[d] : "[unknown]", d > 0 ? ";" : "");
+		fprintf(out, " %ld\n", trie->nodes[i].samples);
+	}
+	fclose(out);
+	return 0;
+}
+
+// variables of a --where predicate
+#define PRED_ARG0 0 // arg0..arg5 are PRED_ARG0..PRED_ARG0 + 5
+#define PRED_RET 6
+#define PRED_TID 7
+#define PRED_DEPTH 8
+#define PRED_NVARS 9
+
+// predicate bytecode, dst = dst <op> src for the binary operators
+#define PRED_OP_CONST 0 // dst = imm
+#define PRED_OP_VAR 1	// dst = vars[imm]
+#define PRED_OP_NEG 2
+#define PRED_OP_NOT 3
+#define PRED_OP_BITNOT 4
+#define PRED_OP_MUL 5
+#define PRED_OP_DIV 6
+#define PRED_OP_MOD 7
+#define PRED_OP_ADD 8
+#define PRED_OP_SUB 9
+#define PRED_OP_SHL 10
+#define PRED_OP_SHR 11
+#define PRED_OP_LT 12
+#define PRED_OP_LE 13
+#define PRED_OP_GT 14
+#define PRED_OP_GE 15
+#define PRED_OP_EQ 16
+#define PRED_OP_NE 17
+#define PRED_OP_AND 18
+#define PRED_OP_XOR 19
+#define PRED_OP_OR 20
+#define PRED_OP_LAND 21
+#define PRED_OP_LOR 22
+#define PRED_OP_INT 23 // (int), the low 32 bits sign-extended
+
+#define PRED_MAX_CODE 128
+#define PRED_REGS 16
+
+struct pred_insn
+{
+	unsigned char op;
+	unsigned char dst;
+	unsigned char src;
+	long imm;
+};
+
+// A --where expression compiled once, the result is in register 0
+struct predicate
+{
+	int ncode;
+	struct pred_insn code[PRED_MAX_CODE];
+	bool uses_args; // the entry has to save the arguments
+};
+
+// recursive descent compiler state
+struct pred_parser
+{
+	const char *p;
+	struct predicate *pred;
+	const char *error;
+};
+
+static const char *pred_var_names[PRED_NVARS] = {"arg0", "arg1", "arg2", "arg3", "arg4", "arg5", "ret", "tid", "depth"};
+
+void pred_emit(struct pred_parser *ps, int op, int dst, int src, long imm)
+{
+	if (dst >= PRED_REGS || src >= PRED_REGS)
+		ps->error = "expression nested too deeply";
+	if (ps->pred->ncode == PRED_MAX_CODE)
+		ps->error = "expression too long";
+	if (ps->error != NULL)
+		return;
+	struct pred_insn *insn = &ps->pred->code[ps->pred->ncode++];
+	insn->op = op;
+	insn->dst = dst;
+	insn->src = src;
+	insn->imm = imm;
+}
+
+// Consume the operator tok if it comes next
+bool pred_accept(struct pred_parser *ps, const char *tok)
+{
+	while (*ps->p == ' ' || *ps->p == '\t')
+		ps->p++;
+	size_t len = strlen(tok);
+	if (strncmp(ps->p, tok, len) != 0)
+		return false;
+	// "<" isn't the start of "<=" or "<<", nor "&" of "&&"
+	if (len == 1 && (ps->p[1] == '=' || ps->p[1] == tok[0]) && strchr("<>&|", tok[0]) != NULL)
+		return false;
+	if (len == 1 && ps->p[1] == '=' && strchr("!=", tok[0]) != NULL)
+		return false;
+	ps->p += len;
+	return true;
+}
+
+void pred_parse_binary(struct pred_parser *ps, int reg, int level);
+
+void pred_parse_unary(struct pred_parser *ps, int reg)
+{
+	if (ps->error != NULL)
+		return;
+	if (pred_accept(ps, "-"))
+	{
+		pred_parse_unary(ps, reg);
+		pred_emit(ps, PRED_OP_NEG, reg, 0, 0);
+		return;
+	}
+	if (pred_accept(ps, "!"))
+	{
+		pred_parse_unary(ps, reg);
+		pred_emit(ps, PRED_OP_NOT, reg, 0, 0);
+		return;
+	}
+	if (pred_accept(ps, "~"))
+	{
+		pred_parse_unary(ps, reg);
+		pred_emit(ps, PRED_OP_BITNOT, reg, 0, 0);
+		return;
+	}
+	if (pred_accept(ps, "("))
+	{
+		const char *group = ps->p;
+		if (pred_accept(ps, "int") && pred_accept(ps, ")"))
+		{
+			pred_parse_unary(ps, reg);
+			pred_emit(ps, PRED_OP_INT, reg, 0, 0);
+			return;
+		}
+		ps->p = group;
+		pred_parse_binary(ps, reg, 0);
+		if (ps->error == NULL && !pred_accept(ps, ")"))
+			ps->error = "expected )";
+		return;
+	}
+	if (*ps->p >= '0' && *ps->p <= '9')
+	{
+		char *end;
+		long value = strtol(ps->p, &end, 0);
+		ps->p = end;
+		pred_emit(ps, PRED_OP_CONST, reg, 0, value);
+		return;
+	}
+	for (int i = 0; i < PRED_NVARS; i++)
+	{
+		size_t len = strlen(pred_var_names[i]);
+		if (strncmp(ps->p, pred_var_names[i], len) == 0 && !(isalnum((unsigned char)ps->p[len]) || ps->p[len] == '_'))
+		{
+			ps->p += len;
+			ps->pred->uses_args |= i < PRED_RET;
+			pred_emit(ps, PRED_OP_VAR, reg, 0, i);
+			return;
+		}
+	}
+	ps->error = "expected a number, variable or (";
+}
+
+// binary operators by precedence, loosest first
+static const struct
+{
+	const char *tok;
+	int op;
+} pred_levels[][6] = {
+	{{"||", PRED_OP_LOR}},
+	{{"&&", PRED_OP_LAND}},
+	{{"|", PRED_OP_OR}},
+	{{"^", PRED_OP_XOR}},
+	{{"&", PRED_OP_AND}},
+	{{"==", PRED_OP_EQ}, {"!=", PRED_OP_NE}},
+	{{"<=", PRED_OP_LE}, {">=", PRED_OP_GE}, {"<", PRED_OP_LT}, {">", PRED_OP_GT}},
+	{{"<<", PRED_OP_SHL}, {">>", PRED_OP_SHR}},
+	{{"+", PRED_OP_ADD}, {"-", PRED_OP_SUB}},
+	{{"*", PRED_OP_MUL}, {"/", PRED_OP_DIV}, {"%", PRED_OP_MOD}},
+};
+#define PRED_NLEVELS (int)(sizeof(pred_levels) / sizeof(*pred_levels))
+
+// Compile the operators of level and tighter into reg, the operands of the
+// right hand side go in reg + 1
+void pred_parse_binary(struct pred_parser *ps, int reg, int level)
+{
+	if (level == PRED_NLEVELS)
+	{
+		pred_parse_unary(ps, reg);
+		return;
+	}
+	pred_parse_binary(ps, reg, level + 1);
+	while (ps->error == NULL)
+	{
+		int op = -1;
+		for (int i = 0; i < 6 && pred_levels[level][i].tok != NULL && op < 0; i++)
+		{
+			if (pred_accept(ps, pred_levels[level][i].tok))
+				op = pred_levels[level][i].op;
+		}
+		if (op < 0)
+			break;
+		pred_parse_binary(ps, reg + 1, level + 1);
+		pred_emit(ps, op, reg, reg + 1, 0);
+	}
+}
+
+// Compile a --where expression, e.g. "ret < 0 && arg0 > 100".
+// Returns -1 and prints where it failed if it isn't valid.
+int predicate_compile(const char *expr, struct predicate *pred)
+{
+	memset(pred, 0, sizeof(*pred));
+	struct pred_parser ps = {.p = expr, .pred = pred};
+	pred_parse_binary(&ps, 0, 0);
+	while (*ps.p == ' ' || *ps.p == '\t')
+		ps.p++;
+	if (ps.error == NULL && *ps.p != '\0')
+		ps.error = "unexpected character";
+	if (ps.error != NULL)
+	{
+		prf_printf("--where: %s at \"%s\"\n", ps.error, ps.p);
+		return -1;
+	}
+	return 0;
+}
+
+// Run the predicate on the values of its variables
+bool predicate_match(const struct predicate *pred, const long vars[PRED_NVARS])
+{
+	long r[PRED_REGS];
+	for (const struct pred_insn *insn = pred->code; insn < pred->code + pred->ncode; insn++)
+	{
+		long *dst = &r[insn->dst];
+		long src = r[insn->src];
+		switch (insn->op)
+		{
+		case PRED_OP_CONST:
+			*dst = insn->imm;
+			break;
+		case PRED_OP_VAR:
+			*dst = vars[insn->imm];
+			break;
+		case PRED_OP_NEG:
+			*dst = (long)(0UL - (unsigned long)*dst);
+			break;
+		case PRED_OP_NOT:
+			*dst = !*dst;
+			break;
+		case PRED_OP_BITNOT:
+			*dst = ~*dst;
+			break;
+		case PRED_OP_MUL:
+			*dst = (long)((unsigned long)*dst * (unsigned long)src);
+			break;
+		case PRED_OP_DIV:
+			*dst = src == 0 || (src == -1 && *dst == LONG_MIN) ? 0 : *dst / src;
+			break;
+		case PRED_OP_MOD:
+			*dst = src == 0 || src == -1 ? 0 : *dst % src;
+			break;
+		case PRED_OP_ADD:
+			*dst = (long)((unsigned long)*dst + (unsigned long)src);
+			break;
+		case PRED_OP_SUB:
+			*dst = (long)((unsigned long)*dst - (unsigned long)src);
+			break;
+		case PRED_OP_SHL:
+			*dst = (long)((unsigned long)*dst << (src & 63));
+			break;
+		case PRED_OP_SHR:
+			*dst >>= src & 63;
+			break;
+		case PRED_OP_LT:
+			*dst = *dst < src;
+			break;
+		case PRED_OP_LE:
+			*dst = *dst <= src;
+			break;
+		case PRED_OP_GT:
+			*dst = *dst > src;
+			break;
+		case PRED_OP_GE:
+			*dst = *dst >= src;
+			break;
+		case PRED_OP_EQ:
+			*dst = *dst == src;
+			break;
+		case PRED_OP_NE:
+			*dst = *dst != src;
+			break;
+		case PRED_OP_AND:
+			*dst &= src;
+			break;
+		case PRED_OP_XOR:
+			*dst ^= src;
+			break;
+		case PRED_OP_OR:
+			*dst |= src;
+			break;
+		case PRED_OP_LAND:
+			*dst = *dst && src;
+			break;
+		case PRED_OP_LOR:
+			*dst = *dst || src;
+			break;
+		case PRED_OP_INT:
+			*dst = (int)(unsigned int)*dst;
+			break;
+		}
+	}
+	return pred->ncode == 0 || r[0] != 0;
+}
+
+// per-thread perf counters, read at the entry and return of traced calls
+#define COUNTER_TASK_CLOCK 0 // ns on cpu
+#define COUNTER_CONTEXT_SWITCHES 1
+#define COUNTER_PAGE_FAULTS 2
+#define COUNTER_INSTRUCTIONS 3 // hardware, when the host has a PMU
+#define COUNTER_CYCLES 4
+#define NCOUNTERS 5
+
+// One group of counters of a thread, so a single read returns all of them
+struct counter_group
+{
+	int fd;	   // group leader
+	int n;	   // counters in the group, 0 if it isn't open
+	int fds[NCOUNTERS];
+	int index[NCOUNTERS]; // position of each counter in a read, -1 if not counted
+};
+
+int perf_counter_open(pid_t tid, int group_fd, unsigned int type, unsigned long long config)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.read_format = PERF_FORMAT_GROUP;
+	int fd = (int)syscall(SYS_perf_event_open, &attr, tid, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+	if (fd < 0 && (errno == EACCES || errno == EPERM))
+	{
+		// perf_event_paranoid only lets us count in user mode
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		fd = (int)syscall(SYS_perf_event_open, &attr, tid, -1, group_fd, PERF_FLAG_FD_CLOEXEC);
+	}
+	return fd;
+}
+
+void counters_close(struct counter_group *g)
+{
+	for (int i = 0; i < g->n; i++)
+		close(g->fds[i]);
+	g->n = 0;
+}
+
+// Open the counters of thread tid, the hardware ones only if the host has them.
+// Returns -1 if not even the software counters can be opened.
+int counters_open(struct counter_group *g, pid_t tid)
+{
+	static const struct
+	{
+		unsigned int type;
+		unsigned long long config;
+	} events[NCOUNTERS] = {
+		[COUNTER_TASK_CLOCK] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK},
+		[COUNTER_CONTEXT_SWITCHES] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+		[COUNTER_PAGE_FAULTS] = {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+		[COUNTER_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+		[COUNTER_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+	};
+	g->n = 0;
+	g->fd = -1;
+	for (int c = 0; c < NCOUNTERS; c++)
+	{
+		g->index[c] = -1;
+		int fd = perf_counter_open(tid, g->fd, events[c].type, events[c].config);
+		if (fd < 0)
+		{
+			if (c <= COUNTER_PAGE_FAULTS)
+			{
+				counters_close(g);
+				return -1;
+			}
+			continue;
+		}
+		if (g->fd < 0)
+			g->fd = fd;
+		g->fds[g->n] = fd;
+		g->index[c] = g->n++;
+	}
+	return 0;
+}
+
+// Read the whole group at once, counters that aren't counted read as 0
+bool counters_read(const struct counter_group *g, unsigned long long values[NCOUNTERS])
+{
+	unsigned long long buf[1 + NCOUNTERS];
+	if (g->n == 0 || read(g->fd, buf, sizeof(buf)) < (ssize_t)((1 + g->n) * sizeof(*buf)))
+		return false;
+	for (int c = 0; c < NCOUNTERS; c++)
+		values[c] = g->index[c] >= 0 ? buf[1 + g->index[c]] : 0;
+	return true;
+}
+
+#define MAX_TRACED_FUNCS 16
+#define HW_SLOTS 4				// DR0-DR3
+#define MAX_TRACED_SYSCALLS 16
+#define MAX_ERRNO 134
+#define PIN_NONE 0
+#define PIN_SAME 1	  // on the tracer's core
+#define PIN_SIBLING 2 // on another hardware thread of the tracer's core
+#define HW_PROMOTE_AFTER 1024	// breakpoint hits before --hw-auto picks functions
+#define STOP_COST_SAMPLES 16	// extra steps at debug register hits to price a stop
+
+// command line options, see usage()
+struct prf_options
+{
+	bool fork_server;
+	const char *stop_symbol;
+	int control_fd;
+	const char *coverage_file;
+	int jobs;
+	pid_t attach_pids[256];
+	int nattach;
+	int nthreads;
+	bool follow;
+	const char *hw_symbols; // comma separated, entry breakpoints in debug registers
+	bool hw_auto;			// move the most hit entry breakpoints to debug registers
+	const char *metrics_name;
+	const char *audit_lib; // LD_AUDIT library of the --audit backend
+	bool lookup;
+	int syscalls[MAX_TRACED_SYSCALLS]; // traced through a seccomp filter
+	int nsyscalls;
+	const char *stacks_file; // folded stacks of the traced functions' calls
+	int pin;				  // PIN_*, where the tracees run relative to their tracer
+	int spin_us;			  // poll for stops this long before blocking in waitpid
+	bool priority;			  // run the tracer threads at a raised priority
+	const struct predicate *where; // only calls matching it are printed and exported
+	bool counters;				   // per-call perf counters of the traced threads
+	const char *alloc_lib;		   // LD_AUDIT library of the --alloc profile
+};
+
+// per-process counters of one syscall traced with seccomp
+struct syscall_stats
+{
+	long calls;
+	long failed;
+	long latency_ns;
+	long errors[MAX_ERRNO]; // failed calls by errno
+};
+
+// per-process state of one traced function
+struct func_state
+{
+	const char *name;
+	unsigned long addr;		// entry breakpoint
+	unsigned long got_addr; // .got.plt slot of an imported function, or 0
+	unsigned long entry_data;
+	int hw_slot; // debug register holding the entry breakpoint, -1 for int3
+	long hits;	 // entry breakpoint hits, recursive calls included
+	int metrics_slot;
+	// outermost call in progress, ret_addr is 0 when there is none
+	unsigned long ret_addr;
+	unsigned long ret_data;
+	unsigned long ret_sp;
+	struct timespec call_start;
+	long args[6]; // saved at the entry for the --where predicate
+	int entry_depth;
+	long calls;
+	long matched; // calls matching the --where predicate
+	// perf counters of the outermost call at its entry, and summed over calls
+	unsigned long long counters_start[NCOUNTERS];
+	unsigned long long counters_total[NCOUNTERS];
+	long counted; // calls in counters_total
+	long stops_start;
+	long counted_stops;				   // our stops inside the counted calls
+	unsigned long long counters_bias; // ns of on-cpu time they cost, taken out of counters_total
+};
+
+// a process traced by prf
+struct target
+{
+	pid_t pid;
+	char exe[PATH_MAX];
+	char path[PATH_MAX]; // exe made canonical, what the calls are aggregated on
+	bool print_calls;
+	int parent;	  // index of the parent in its tracer_shard, -1 for roots
+	bool exited;  // exited, or replaced by the image it exec'd
+	bool pending; // forked child stopped before the parent's fork event arrived
+	bool attached; // a running process prf attached to, or one of its children
+	bool vfork_stripped; // breakpoints taken out while a vfork child shares its memory
+	const struct prf_options *opts;
+	struct metrics *metrics; // live counters, NULL if not exported
+	const struct predicate *where; // filter of the printed and exported calls, or NULL
+	struct counter_group counters; // not open unless opts->counters
+	long stops; // ptrace stops, each one is a context switch the tracer caused
+	// stop latency of this target alone: when the tracer last resumed it, and the
+	// single steps it made during the current stop, timed apart from the handling
+	struct timespec resumed;
+	long steps;
+	double step_us;
+	// counters of single steps over entry breakpoints, what one stop costs the target
+	unsigned long long stop_cost[NCOUNTERS];
+	long stop_samples;
+	struct stack_trie *stacks; // stacks captured on entries, NULL if not captured
+	const struct unwind_info *unwind;
+	long traps;
+	bool hw_promoted;
+	int nfuncs;
+	struct func_state funcs[MAX_TRACED_FUNCS];
+	int syscall_idx; // syscall between its seccomp and exit stops, -1 if none
+	struct timespec syscall_start;
+	struct syscall_stats syscalls[MAX_TRACED_SYSCALLS];
+};
+
+// Resolve symbol_name in t->exe and add it to the traced functions.
+// Returns find_symbol's error value.
+int target_add_func(struct target *t, const char *symbol_name)
+{
+	int err = 0;
+	unsigned long addr = find_symbol(symbol_name, t->exe, &err);
+	if (err <= 0 || t->nfuncs == MAX_TRACED_FUNCS)
+		return err;
+
+	struct func_state *f = &t->funcs[t->nfuncs++];
+	memset(f, 0, sizeof(*f));
+	f->name = symbol_name;
+	f->hw_slot = -1;
+	f->metrics_slot = t->metrics ? metrics_slot(t->metrics, symbol_name) : -1;
+	if (err == 2)
+		f->got_addr = addr;
+	else
+		f->addr = addr;
+	return err;
+}
+
+// true if name is one of the comma separated names in list
+bool symbol_in_list(const char *list, const char *name)
+{
+	size_t len = strlen(name);
+	for (const char *p = list; p != NULL && *p != '\0'; p = strchr(p, ','), p = p ? p + 1 : NULL)
+	{
+		if (strncmp(p, name, len) == 0 && (p[len] == ',' || p[len] == '\0'))
+			return true;
+	}
+	return false;
+}
+
+// Put the entry breakpoint of f in a free debug register as an execute
+// breakpoint, which needs no text patching and no single step. The caller
+// removes the int3 if there is one. Returns false if no register is available.
+bool target_set_hw_breakpoint(struct target *t, struct func_state *f)
+{
+	bool used[HW_SLOTS] = {false};
+	for (int i = 0; i < t->nfuncs; i++)
+	{
+		if (t->funcs[i].hw_slot >= 0)
+			used[t->funcs[i].hw_slot] = true;
+	}
+	int slot = 0;
+	while (slot < HW_SLOTS && used[slot])
+		slot++;
+	if (slot == HW_SLOTS)
+		return false;
+
+	if (ptrace(PTRACE_POKEUSER, t->pid, (void *)offsetof(struct user, u_debugreg[slot]), (void *)f->addr) < 0)
+		return false;
+	unsigned long dr7 = ptrace(PTRACE_PEEKUSER, t->pid, (void *)offsetof(struct user, u_debugreg[7]), NULL);
+	// local enable, RW = 00 (execute) and LEN = 00
+	dr7 &= ~(0xfUL << (16 + slot * 4));
+	dr7 |= 1UL << (slot * 2);
+	if (ptrace(PTRACE_POKEUSER, t->pid, (void *)offsetof(struct user, u_debugreg[7]), (void *)dr7) < 0)
+		return false;
+	f->hw_slot = slot;
+	return true;
+}
+
+// Set the entry breakpoints of a stopped target, in debug registers for the
+// functions named by --hw while they last and as int3 for the rest
+void target_arm(struct target *t)
+{
+	for (int i = 0; i < t->nfuncs; i++)
+	{
+		struct func_state *f = &t->funcs[i];
+		if (f->got_addr != 0)
+			f->addr = ptrace(PTRACE_PEEKDATA, t->pid, (void *)f->got_addr, NULL);
+		f->hw_slot = -1;
+		if (t->opts != NULL && symbol_in_list(t->opts->hw_symbols, f->name) && target_set_hw_breakpoint(t, f))
+			continue;
+		f->entry_data = add_breakpoint(f->addr, t->pid);
+	}
+}
+
+// Debug registers aren't inherited, set them again in a forked child that
+// took over its parent's state, falling back to int3 if that fails
+void target_rearm_hw(struct target *t)
+{
+	for (int i = 0; i < t->nfuncs; i++)
+	{
+		struct func_state *f = &t->funcs[i];
+		if (f->hw_slot < 0)
+			continue;
+		f->hw_slot = -1;
+		if (!target_set_hw_breakpoint(t, f))
+			f->entry_data = add_breakpoint(f->addr, t->pid);
+	}
+}
+
+// --hw-auto: move the most hit int3 entry breakpoints to the free debug registers
+void target_promote_hw(struct target *t)
+{
+	t->hw_promoted = true;
+	while (true)
+	{
+		struct func_state *hottest = NULL;
+		for (int i = 0; i < t->nfuncs; i++)
+		{
+			struct func_state *f = &t->funcs[i];
+			if (f->hw_slot < 0 && f->hits > 0 && (hottest == NULL || f->hits > hottest->hits))
+				hottest = f;
+		}
+		if (hottest == NULL || !target_set_hw_breakpoint(t, hottest))
+			return;
+		remove_breakpoint(hottest->addr, hottest->entry_data, t->pid);
+	}
+}
+
+// The outermost call of f returned, regs are at its return breakpoint
+void target_on_return(struct target *t, struct func_state *f, struct user_regs_struct *regs)
+{
+	f->calls++;
+	bool match = true;
+	if (t->where != NULL)
+	{
+		long vars[PRED_NVARS];
+		memcpy(vars + PRED_ARG0, f->args, sizeof(f->args));
+		vars[PRED_RET] = (long)regs->rax;
+		vars[PRED_TID] = t->pid;
+		vars[PRED_DEPTH] = f->entry_depth;
+		match = predicate_match(t->where, vars);
+		f->matched += match;
+	}
+	unsigned long long counters[NCOUNTERS];
+	if (match && counters_read(&t->counters, counters))
+	{
+		// the call's own counts, without the stops at our breakpoints inside it:
+		// each one is a context switch, plus the trap and resume it cost the target
+		unsigned long long stops = (unsigned long long)(t->stops - f->stops_start);
+		for (int c = 0; c < NCOUNTERS; c++)
+		{
+			unsigned long long delta = counters[c] - f->counters_start[c];
+			unsigned long long bias = c == COUNTER_CONTEXT_SWITCHES ? stops
+									  : t->stop_samples > 0			? stops * t->stop_cost[c] / (unsigned long long)t->stop_samples
+																	: 0;
+			bias = bias < delta ? bias : delta;
+			f->counters_total[c] += delta - bias;
+			if (c == COUNTER_TASK_CLOCK)
+				f->counters_bias += bias;
+		}
+		f->counted_stops += (long)stops;
+		f->counted++;
+	}
+	if (t->print_calls && match)
+		prf_printf("run #%ld returned with %d\n", f->calls, (int)regs->rax);
+	if (f->metrics_slot >= 0 && match)
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		long latency_ns = (now.tv_sec - f->call_start.tv_sec) * 1000000000L + now.tv_nsec - f->call_start.tv_nsec;
+		if (t->where != NULL)
+			metrics_on_entry(t->metrics, f->metrics_slot);
+		metrics_on_return(t->metrics, f->metrics_slot, latency_ns, (int)regs->rax);
+	}
+
+	// the return breakpoint is one-shot, no need to step over it
+	remove_breakpoint(f->ret_addr, f->ret_data, t->pid);
+	regs->rip -= 1;
+	ptrace(PTRACE_SETREGS, t->pid, NULL, regs);
+	f->ret_addr = 0;
+
+	// the first call resolved the symbol, move to the real function
+	if (f->got_addr != 0)
+	{
+		unsigned long resolved = ptrace(PTRACE_PEEKDATA, t->pid, (void *)f->got_addr, NULL);
+		if (resolved != f->addr && f->hw_slot >= 0)
+		{
+			f->addr = resolved;
+			ptrace(PTRACE_POKEUSER, t->pid, (void *)offsetof(struct user, u_debugreg[f->hw_slot]), (void *)f->addr);
+		}
+		else if (resolved != f->addr)
+		{
+			remove_breakpoint(f->addr, f->entry_data, t->pid);
+			f->addr = resolved;
+			f->entry_data = add_breakpoint(f->addr, t->pid);
+		}
+	}
+}
+
+// Step t over the instruction at a breakpoint and patch it back, a round trip
+// of its own that the stop latency counts apart
+void target_step_breakpoint(struct target *t, unsigned long addr, unsigned long data)
+{
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	step_breakpoint(addr, data, t->pid);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	t->step_us += elapsed_us(&start, &end);
+	t->steps++;
+	t->stops++;
+}
+
+// Step t over the first instruction of f, past its entry breakpoint. The counters
+// of the round trip are a sample of what one of our stops costs the target.
+void target_step_entry(struct target *t, struct func_state *f, bool hw_hit)
+{
+	unsigned long long before[NCOUNTERS], after[NCOUNTERS];
+	bool sampled = counters_read(&t->counters, before);
+	if (hw_hit)
+	{
+		int wait_status;
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		ptrace(PTRACE_SINGLESTEP, t->pid, NULL, NULL);
+		wait_tracee(t->pid, &wait_status);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		t->step_us += elapsed_us(&start, &end);
+		t->steps++;
+		t->stops++;
+	}
+	else
+		target_step_breakpoint(t, f->addr, f->entry_data);
+	// a sample the target was also preempted in would overstate the cost
+	if (sampled && counters_read(&t->counters, after) && after[COUNTER_CONTEXT_SWITCHES] - before[COUNTER_CONTEXT_SWITCHES] <= 1)
+	{
+		for (int c = 0; c < NCOUNTERS; c++)
+			t->stop_cost[c] += after[c] - before[c];
+		t->stop_samples++;
+	}
+}
+
+// Handle a SIGTRAP stop of t. Returns false if it wasn't one of our breakpoints.
+bool target_on_trap(struct target *t)
+{
+	struct user_regs_struct regs;
+	ptrace(PTRACE_GETREGS, t->pid, NULL, &regs);
+	unsigned long bp_addr = regs.rip - 1;
+
+	// B0-B3 of DR6 tell which debug registers fired. They aren't cleared by an
+	// int3 trap, so clear them here for the next stop to read only its own.
+	unsigned long dr6 = 0;
+	for (int i = 0; i < t->nfuncs && dr6 == 0; i++)
+	{
+		if (t->funcs[i].hw_slot >= 0)
+			dr6 = ptrace(PTRACE_PEEKUSER, t->pid, (void *)offsetof(struct user, u_debugreg[6]), NULL);
+	}
+	if (dr6 & 0xf)
+		ptrace(PTRACE_POKEUSER, t->pid, (void *)offsetof(struct user, u_debugreg[6]), (void *)(dr6 & ~0xfUL));
+
+	bool handled = false;
+	for (int i = 0; i < t->nfuncs && !handled; i++)
+	{
+		struct func_state *f = &t->funcs[i];
+		// debug register hits stop before the instruction runs, int3 after
+		bool hw_hit = f->hw_slot >= 0 && (dr6 & (1UL << f->hw_slot));
+		if (hw_hit || (f->hw_slot < 0 && bp_addr == f->addr))
+		{
+			f->hits++;
+			if (t->stacks != NULL)
+			{
+				if (t->unwind == NULL)
+					t->unwind = get_unwind_info(t->exe);
+				stack_capture(t->stacks, t->unwind, t->pid, f->name, &regs);
+			}
+			// outermost call, catch its return
+			bool outermost = f->ret_addr == 0;
+			if (outermost)
+			{
+				f->ret_addr = ptrace(PTRACE_PEEKDATA, t->pid, (void *)regs.rsp, NULL);
+				f->ret_sp = regs.rsp + 8;
+				f->ret_data = add_breakpoint(f->ret_addr, t->pid);
+				clock_gettime(CLOCK_MONOTONIC, &f->call_start);
+				// with --where the call is only counted at its return, if it matched
+				if (f->metrics_slot >= 0 && t->where == NULL)
+					metrics_on_entry(t->metrics, f->metrics_slot);
+				if (t->where != NULL)
+				{
+					// calls of the other traced functions in progress around this one
+					f->entry_depth = 0;
+					for (int j = 0; j < t->nfuncs; j++)
+						f->entry_depth += j != i && t->funcs[j].ret_addr != 0;
+					if (t->where->uses_args)
+					{
+						f->args[0] = (long)regs.rdi;
+						f->args[1] = (long)regs.rsi;
+						f->args[2] = (long)regs.rdx;
+						f->args[3] = (long)regs.rcx;
+						f->args[4] = (long)regs.r8;
+						f->args[5] = (long)regs.r9;
+					}
+				}
+			}
+			// the kernel sets RF on debug register hits, so the tracee just resumes,
+			// unless it's stepped for a sample of the stop cost
+			if (!hw_hit || (outermost && t->counters.n > 0 && t->stop_samples < STOP_COST_SAMPLES))
+				target_step_entry(t, f, hw_hit);
+			// counted from the re-armed entry on, its trap and step aren't the call's
+			if (outermost)
+			{
+				counters_read(&t->counters, f->counters_start);
+				f->stops_start = t->stops;
+			}
+			handled = true;
+		}
+		else if (f->ret_addr != 0 && bp_addr == f->ret_addr)
+		{
+			if (regs.rsp == f->ret_sp)
+				target_on_return(t, f, &regs);
+			else // same return address hit from a deeper frame
+				target_step_breakpoint(t, f->ret_addr, f->ret_data);
+			handled = true;
+		}
+	}
+
+	t->traps += handled;
+	if (t->opts != NULL && t->opts->hw_auto && !t->hw_promoted && t->traps >= HW_PROMOTE_AFTER)
+		target_promote_hw(t);
+	return handled;
+}
+
+// Seccomp stop of t on entry to a traced syscall, the filter's event message
+// is its index in opts->syscalls. The caller resumes t with PTRACE_SYSCALL to
+// get the exit stop.
+void target_on_syscall_entry(struct target *t)
+{
+	unsigned long idx;
+	ptrace(PTRACE_GETEVENTMSG, t->pid, NULL, &idx);
+	if (idx >= MAX_TRACED_SYSCALLS)
+		return;
+	t->syscall_idx = (int)idx;
+	clock_gettime(CLOCK_MONOTONIC, &t->syscall_start);
+}
+
+// Count the syscall t entered at its last seccomp stop, which returned ret
+void target_end_syscall(struct target *t, long ret)
+{
+	if (t->syscall_idx < 0)
+		return;
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	struct syscall_stats *s = &t->syscalls[t->syscall_idx];
+	s->calls++;
+	s->latency_ns += (now.tv_sec - t->syscall_start.tv_sec) * 1000000000L + now.tv_nsec - t->syscall_start.tv_nsec;
+	if (ret < 0 && ret >= -4095)
+	{
+		s->failed++;
+		if (-ret < MAX_ERRNO)
+			s->errors[-ret]++;
+	}
+	t->syscall_idx = -1;
+}
+
+// Syscall exit stop of t
+void target_on_syscall_exit(struct target *t)
+{
+	struct user_regs_struct regs;
+	ptrace(PTRACE_GETREGS, t->pid, NULL, &regs);
+	target_end_syscall(t, (long)regs.rax);
+}
+
+// A forked child inherits the parent's breakpoints, clear them and stop tracing
+// the stopped child.
+void target_release_child(struct target *t, pid_t child, bool shared_memory)
+{
+	for (int i = 0; i < t->nfuncs; i++)
+	{
+		struct func_state *f = &t->funcs[i];
+		// in reverse order of arming, ret_data may contain the entry breakpoint
+		if (f->ret_addr != 0)
+			remove_breakpoint(f->ret_addr, f->ret_data, child);
+		if (f->hw_slot < 0)
+			remove_breakpoint(f->addr, f->entry_data, child);
+	}
+	ptrace(PTRACE_DETACH, child, NULL, NULL);
+	// a vfork child shares the memory of t, which sleeps until it execs or
+	// exits: t gets its breakpoints back on its vfork-done stop
+	t->vfork_stripped = shared_memory;
+}
+
+// The vfork child of t released its memory, arm the breakpoints it was run
+// without again, in the order they were armed in
+void target_on_vfork_done(struct target *t)
+{
+	for (int i = 0; t->vfork_stripped && i < t->nfuncs; i++)
+	{
+		struct func_state *f = &t->funcs[i];
+		if (f->hw_slot < 0)
+			f->entry_data = add_breakpoint(f->addr, t->pid);
+		if (f->ret_addr != 0)
+			f->ret_data = add_breakpoint(f->ret_addr, t->pid);
+	}
+	t->vfork_stripped = false;
+}
+
+// true if a SIGTRAP is queued for the thread pid but not delivered yet
+bool sigtrap_pending(pid_t pid)
+{
+	char path[64], line[128];
+	snprintf(path, sizeof(path), "/proc/%d/status", pid);
+	FILE *fptr = fopen(path, "r");
+	unsigned long long pending = 0;
+	while (fptr != NULL && fgets(line, sizeof(line), fptr) != NULL)
+	{
+		if (sscanf(line, "SigPnd: %llx", &pending) == 1)
+			break;
+	}
+	if (fptr != NULL)
+		fclose(fptr);
+	return pending & (1ULL << (SIGTRAP - 1));
+}
+
+// Take every breakpoint out of the attached target t and detach from it, so
+// it goes on running as if prf had never been there. It is interrupted first,
+// it may be stopped at an int3 that prf hasn't handled yet.
+void target_detach(struct target *t)
+{
+	int wait_status;
+	if (ptrace(PTRACE_INTERRUPT, t->pid, NULL, NULL) < 0 || wait_tracee(t->pid, &wait_status) < 0 ||
+		!WIFSTOPPED(wait_status))
+		return;
+	// a breakpoint hit just before the interrupt has its SIGTRAP still queued,
+	// undelivered it would kill the target after the detach
+	if (wait_status >> 16 == PTRACE_EVENT_STOP && sigtrap_pending(t->pid))
+	{
+		ptrace(PTRACE_CONT, t->pid, NULL, NULL);
+		if (wait_tracee(t->pid, &wait_status) < 0 || !WIFSTOPPED(wait_status))
+			return;
+	}
+	int sig = WSTOPSIG(wait_status);
+	struct user_regs_struct regs;
+	ptrace(PTRACE_GETREGS, t->pid, NULL, &regs);
+	for (int i = 0; i < t->nfuncs; i++)
+	{
+		struct func_state *f = &t->funcs[i];
+		// only a trap signal is an int3 left unhandled, after the single step
+		// over a one byte instruction rip is also at the entry + 1
+		if (sig == SIGTRAP && wait_status >> 16 == 0 && ((f->hw_slot < 0 && regs.rip - 1 == f->addr) || (f->ret_addr != 0 && regs.rip - 1 == f->ret_addr)))
+		{
+			// run the instruction under the int3 after all
+			regs.rip -= 1;
+			ptrace(PTRACE_SETREGS, t->pid, NULL, &regs);
+			break;
+		}
+	}
+	for (int i = 0; i < t->nfuncs; i++)
+	{
+		struct func_state *f = &t->funcs[i];
+		// in reverse order of arming, ret_data may contain the entry breakpoint
+		if (f->ret_addr != 0)
+			remove_breakpoint(f->ret_addr, f->ret_data, t->pid);
+		if (f->hw_slot < 0)
+			remove_breakpoint(f->addr, f->entry_data, t->pid);
+	}
+	ptrace(PTRACE_POKEUSER, t->pid, (void *)offsetof(struct user, u_debugreg[7]), NULL);
+	// a signal on its way to the target is delivered, our traps and events aren't
+	ptrace(PTRACE_DETACH, t->pid, NULL, (void *)(long)(sig == SIGTRAP || wait_status >> 16 ? 0 : sig));
+}
+
+// Trace calls to the function at addr in the stopped process pid until it exits.
+// Its entry breakpoint is already armed, over the original word entry_data.
+// got_addr is the .got.plt slot of an imported function (0 otherwise), which is
+// re-read after every call so the breakpoint follows lazy binding.
+// Only the outermost call of a recursion is reported. Returns the number of calls.
+int trace_calls(pid_t pid, unsigned long addr, unsigned long got_addr, unsigned long entry_data, const struct predicate *where)
+{
+	int wait_status;
+	struct target t = {.pid = pid, .print_calls = true, .where = where, .nfuncs = 1};
+	t.funcs[0].addr = addr;
+	t.funcs[0].got_addr = got_addr;
+	t.funcs[0].hw_slot = -1;
+	t.funcs[0].metrics_slot = -1;
+	t.funcs[0].entry_data = entry_data;
+	ptrace(PTRACE_SETOPTIONS, pid, NULL,
+		   (void *)(PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEVFORKDONE | PTRACE_O_EXITKILL));
+
+	ptrace(PTRACE_CONT, pid, NULL, NULL);
+	waitpid(pid, &wait_status, __WALL);
+	while (WIFSTOPPED(wait_status))
+	{
+		int sig = WSTOPSIG(wait_status);
+		int event = wait_status >> 16;
+		if (sig == SIGTRAP && (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK))
+		{
+			// children are not followed here, but must not inherit the breakpoints
+			unsigned long child;
+			ptrace(PTRACE_GETEVENTMSG, pid, NULL, &child);
+			waitpid((pid_t)child, &wait_status, __WALL);
+			target_release_child(&t, (pid_t)child, event == PTRACE_EVENT_VFORK);
+			sig = 0;
+		}
+		else if (sig == SIGTRAP && event == PTRACE_EVENT_VFORK_DONE)
+		{
+			target_on_vfork_done(&t);
+			sig = 0;
+		}
+		else if (sig == SIGTRAP)
+		{
+			sig = 0;
+			target_on_trap(&t);
+		}
+		ptrace(PTRACE_CONT, pid, NULL, (void *)(long)sig);
+		waitpid(pid, &wait_status, __WALL);
+	}
+	return t.funcs[0].calls;
+}
+
+void count_calls(unsigned long addr, pid_t pid, bool dynamic_addr, const struct predicate *where)
+{
+	int wait_status;
+	if (waitpid(pid, &wait_status, __WALL) < 0 || !WIFSTOPPED(wait_status))
+		return;
+	unsigned long got_addr = 0;
+	if (dynamic_addr)
+	{
+		got_addr = addr;
+		addr = ptrace(PTRACE_PEEKTEXT, pid, (void *)got_addr, NULL);
+	}
+	trace_calls(pid, addr, got_addr, add_breakpoint(addr, pid), where);
+}
+
+// syscalls accepted by name in --syscalls, others are given by number
+static const struct
+{
+	const char *name;
+	int nr;
+} syscall_names[] = {
+#define SYSCALL_NAME(name) {#name, SYS_##name}
+	SYSCALL_NAME(read), SYSCALL_NAME(write), SYSCALL_NAME(open), SYSCALL_NAME(close),
+	SYSCALL_NAME(stat), SYSCALL_NAME(fstat), SYSCALL_NAME(lstat), SYSCALL_NAME(poll),
+	SYSCALL_NAME(lseek), SYSCALL_NAME(mmap), SYSCALL_NAME(mprotect), SYSCALL_NAME(munmap),
+	SYSCALL_NAME(brk), SYSCALL_NAME(ioctl), SYSCALL_NAME(pread64), SYSCALL_NAME(pwrite64),
+	SYSCALL_NAME(readv), SYSCALL_NAME(writev), SYSCALL_NAME(access), SYSCALL_NAME(pipe),
+	SYSCALL_NAME(select), SYSCALL_NAME(sched_yield), SYSCALL_NAME(madvise), SYSCALL_NAME(dup),
+	SYSCALL_NAME(dup2), SYSCALL_NAME(nanosleep), SYSCALL_NAME(getpid), SYSCALL_NAME(socket),
+	SYSCALL_NAME(connect), SYSCALL_NAME(accept), SYSCALL_NAME(sendto), SYSCALL_NAME(recvfrom),
+	SYSCALL_NAME(sendmsg), SYSCALL_NAME(recvmsg), SYSCALL_NAME(clone), SYSCALL_NAME(fork),
+	SYSCALL_NAME(vfork), SYSCALL_NAME(execve), SYSCALL_NAME(exit), SYSCALL_NAME(wait4), SYSCALL_NAME(kill),
+	SYSCALL_NAME(fcntl), SYSCALL_NAME(flock), SYSCALL_NAME(fsync), SYSCALL_NAME(fdatasync),
+	SYSCALL_NAME(truncate), SYSCALL_NAME(ftruncate), SYSCALL_NAME(getdents64), SYSCALL_NAME(getcwd),
+	SYSCALL_NAME(chdir), SYSCALL_NAME(rename), SYSCALL_NAME(mkdir), SYSCALL_NAME(rmdir),
+	SYSCALL_NAME(unlink), SYSCALL_NAME(readlink), SYSCALL_NAME(chmod), SYSCALL_NAME(futex),
+	SYSCALL_NAME(epoll_wait), SYSCALL_NAME(clock_gettime), SYSCALL_NAME(clock_nanosleep),
+	SYSCALL_NAME(openat), SYSCALL_NAME(newfstatat), SYSCALL_NAME(unlinkat), SYSCALL_NAME(renameat),
+	SYSCALL_NAME(pipe2), SYSCALL_NAME(getrandom), SYSCALL_NAME(statx), SYSCALL_NAME(sync_file_range),
+	SYSCALL_NAME(exit_group),
+#undef SYSCALL_NAME
+};
+
+// Syscall number of a --syscalls name or number, -1 if unknown
+int syscall_nr(const char *name)
+{
+	char *end;
+	long nr = strtol(name, &end, 10);
+	if (*name != '\0' && *end == '\0')
+		return nr >= 0 ? (int)nr : -1;
+	for (size_t i = 0; i < sizeof(syscall_names) / sizeof(*syscall_names); i++)
+	{
+		if (strcmp(syscall_names[i].name, name) == 0)
+			return syscall_names[i].nr;
+	}
+	return -1;
+}
+
+const char *syscall_name(int nr)
+{
+	for (size_t i = 0; i < sizeof(syscall_names) / sizeof(*syscall_names); i++)
+	{
+		if (syscall_names[i].nr == nr)
+			return syscall_names[i].name;
+	}
+	return NULL;
+}
+
+// Install a seccomp filter stopping the calling process in its tracer
+// (SECCOMP_RET_TRACE, with the index in syscalls as the event message) on the
+// given syscalls, every other syscall runs without a stop.
+// Returns -1 on failure.
+int install_syscall_filter(const int *syscalls, int nsyscalls)
+{
+	struct sock_filter filter[5 + 2 * MAX_TRACED_SYSCALLS];
+	int n = 0;
+	filter[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, arch));
+	filter[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, AUDIT_ARCH_X86_64, 1, 0);
+	filter[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+	filter[n++] = (struct sock_filter)BPF_STMT(BPF_LD | BPF_W | BPF_ABS, offsetof(struct seccomp_data, nr));
+	for (int i = 0; i < nsyscalls && i < MAX_TRACED_SYSCALLS; i++)
+	{
+		filter[n++] = (struct sock_filter)BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, syscalls[i], 0, 1);
+		filter[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_TRACE | i);
+	}
+	filter[n++] = (struct sock_filter)BPF_STMT(BPF_RET | BPF_K, SECCOMP_RET_ALLOW);
+
+	struct sock_fprog prog = {.len = n, .filter = filter};
+	if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) < 0)
+		return -1;
+	return prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog);
+}
+
+// Start program_name under ptrace, stopped at its exec. With nsyscalls > 0 it
+// runs under a seccomp filter tracing these syscalls, see install_syscall_filter().
+pid_t run_target(const char *program_name, char *const args[], const int *syscalls, int nsyscalls)
+{
+	pid_t pid = fork();
+	if (pid > 0)
+	{
+		// printf("RUNNING program %s on new process %d\n", program_name, pid);
+		if (nsyscalls > 0)
+		{
+			// a SECCOMP_RET_TRACE without PTRACE_O_TRACESECCOMP fails the syscall
+			// with ENOSYS, so the option is set before the child installs the filter
+			int wait_status;
+			wait_tracee(pid, &wait_status);
+			ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(PTRACE_O_TRACESECCOMP | PTRACE_O_TRACESYSGOOD | PTRACE_O_EXITKILL));
+			ptrace(PTRACE_CONT, pid, NULL, NULL);
+		}
+		return pid;
+	}
+
+	else if (pid == 0)
+	{
+		// the copy of prf must never get back to its caller's tracing loop
+		if(ptrace(PTRACE_TRACEME, 0, NULL, NULL) < 0)
+		{
+			perror("ptrace");
+			_exit(127);
+		}
+		if (nsyscalls > 0)
+		{
+			raise(SIGSTOP);
+			if (install_syscall_filter(syscalls, nsyscalls) < 0)
+			{
+				perror("seccomp");
+				_exit(127);
+			}
+		}
+		// multi_trace blocks SIGINT and SIGTERM in its threads, not in the target
+		sigset_t none;
+		sigemptyset(&none);
+		sigprocmask(SIG_SETMASK, &none, NULL);
+		// printf("running program %s on new process %d\n", program_name, pid);
+		execv(program_name, args);
+		perror(program_name);
+		_exit(127);
+	}
+	else
+	{
+		perror("fork");
+		// printf("pid < 0 line 237 \n");
+		return -1;
+	}
+}
+
+// Execute one syscall inside the stopped process pid, at its current rip, and
+// restore its registers and text afterwards. A ptrace event raised by the call
+// (e.g. fork under PTRACE_O_TRACEFORK) stores its message in event_msg.
+// Returns the syscall's return value.
+long inject_syscall(pid_t pid, long nr, const unsigned long args[6], unsigned long *event_msg)
+{
+	int wait_status;
+	struct user_regs_struct saved_regs, regs;
+	ptrace(PTRACE_GETREGS, pid, NULL, &saved_regs);
+	unsigned long saved_text = ptrace(PTRACE_PEEKTEXT, pid, (void *)saved_regs.rip, NULL);
+
+	// 0f 05 = syscall
+	ptrace(PTRACE_POKETEXT, pid, (void *)saved_regs.rip, (void *)((saved_text & ~0xffffUL) | 0x050f));
+	regs = saved_regs;
+	regs.rax = nr;
+	regs.rdi = args[0];
+	regs.rsi = args[1];
+	regs.rdx = args[2];
+	regs.r10 = args[3];
+	regs.r8 = args[4];
+	regs.r9 = args[5];
+	ptrace(PTRACE_SETREGS, pid, NULL, &regs);
+
+	while (true)
+	{
+		ptrace(PTRACE_SINGLESTEP, pid, NULL, NULL);
+		if (waitpid(pid, &wait_status, __WALL) < 0 || !WIFSTOPPED(wait_status))
+			return -ESRCH;
+		if (WSTOPSIG(wait_status) != SIGTRAP)
+			continue; // suppress e.g. SIGCHLD, the caller restores the context anyway
+		if (wait_status >> 16 != 0)
+		{
+			if (event_msg != NULL)
+				ptrace(PTRACE_GETEVENTMSG, pid, NULL, event_msg);
+			continue;
+		}
+		break;
+	}
+
+	ptrace(PTRACE_GETREGS, pid, NULL, &regs);
+	ptrace(PTRACE_POKETEXT, pid, (void *)saved_regs.rip, (void *)saved_text);
+	ptrace(PTRACE_SETREGS, pid, NULL, &saved_regs);
+	return regs.rax;
+}
+
+#define FORK_SERVER_ARENA_SIZE (64 * 1024)
+#define FORK_SERVER_MAX_ARGS 256
+
+// Lay out argv for a forked run inside the arena at arena_addr (an address in
+// the tracee) and copy it over with a single process_vm_writev.
+// Returns argc, or -1 if the arguments don't fit.
+int write_run_args(pid_t pid, unsigned long arena_addr, char *exe_file_name, char *line)
+{
+	static char arena[FORK_SERVER_ARENA_SIZE];
+	char *words[FORK_SERVER_MAX_ARGS];
+	int argc = 0;
+	words[argc++] = exe_file_name;
+	for (char *word = strtok(line, " \t\n"); word != NULL; word = strtok(NULL, " \t\n"))
+	{
+		if (argc == FORK_SERVER_MAX_ARGS - 1)
+			return -1;
+		words[argc++] = word;
+	}
+
+	unsigned long *argv_out = (unsigned long *)arena;
+	size_t offset = (argc + 1) * sizeof(unsigned long);
+	for (int i = 0; i < argc; i++)
+	{
+		size_t len = strlen(words[i]) + 1;
+		if (offset + len > FORK_SERVER_ARENA_SIZE)
+			return -1;
+		memcpy(arena + offset, words[i], len);
+		argv_out[i] = arena_addr + offset;
+		offset += len;
+	}
+	argv_out[argc] = 0;
+
+	struct iovec local = {arena, offset};
+	struct iovec remote = {(void *)arena_addr, offset};
+	if (process_vm_writev(pid, &local, 1, &remote, 1, 0) != (ssize_t)offset)
+		return -1;
+	return argc;
+}
+
+// Start exe_file_name once, stop it at stop_symbol with the breakpoint on addr
+// armed, then fork a fresh copy of that image for every line (the run's
+// arguments) read from control_fd and trace it to completion.
+int fork_server(char *exe_file_name, unsigned long addr, bool dynamic_addr, const char *stop_symbol, int control_fd,
+				const struct predicate *where)
+{
+	int err = 0;
+	unsigned long stop_addr = find_symbol(stop_symbol, exe_file_name, &err);
+	if (err != 1)
+	{
+		prf_printf("%s can't be used as a fork-server stop point\n", stop_symbol);
+		return -1;
+	}
+
+	// the runs inherit the template's stdin, which mustn't be the control lines
+	if (control_fd == STDIN_FILENO)
+	{
+		control_fd = dup(STDIN_FILENO);
+		int null_fd = open("/dev/null", O_RDONLY);
+		if (control_fd < 0 || null_fd < 0 || dup2(null_fd, STDIN_FILENO) < 0)
+		{
+			perror("fork-server stdin");
+			return -1;
+		}
+		close(null_fd);
+	}
+	// only main's arguments are known to be argc and argv
+	bool at_main = strcmp(stop_symbol, "main") == 0;
+
+	char *const template_args[] = {exe_file_name, NULL};
+	pid_t template_pid = run_target(exe_file_name, template_args, NULL, 0);
+	if (template_pid <= 0)
+		return -1;
+
+	// run the template up to the stop point
+	int wait_status;
+	waitpid(template_pid, &wait_status, __WALL);
+	ptrace(PTRACE_SETOPTIONS, template_pid, NULL, (void *)(PTRACE_O_TRACEFORK | PTRACE_O_EXITKILL));
+	unsigned long stop_data = add_breakpoint(stop_addr, template_pid);
+	ptrace(PTRACE_CONT, template_pid, NULL, NULL);
+	waitpid(template_pid, &wait_status, __WALL);
+	if (!WIFSTOPPED(wait_status) || WSTOPSIG(wait_status) != SIGTRAP)
+	{
+		prf_printf("%s exited before reaching %s\n", exe_file_name, stop_symbol);
+		return -1;
+	}
+	struct user_regs_struct regs;
+	remove_breakpoint(stop_addr, stop_data, template_pid);
+	ptrace(PTRACE_GETREGS, template_pid, NULL, &regs);
+	regs.rip = stop_addr;
+	ptrace(PTRACE_SETREGS, template_pid, NULL, &regs);
+
+	unsigned long got_addr = 0;
+	if (dynamic_addr)
+	{
+		got_addr = addr;
+		addr = ptrace(PTRACE_PEEKDATA, template_pid, (void *)got_addr, NULL);
+	}
+	// every run is forked with the breakpoint armed
+	unsigned long entry_data = add_breakpoint(addr, template_pid);
+
+	// every fork inherits this mapping, the runs' argv is written into it
+	const unsigned long mmap_args[6] = {0, FORK_SERVER_ARENA_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1UL, 0};
+	unsigned long arena_addr = inject_syscall(template_pid, SYS_mmap, mmap_args, NULL);
+	if ((long)arena_addr < 0)
+	{
+		prf_printf("can't map the fork-server argument arena\n");
+		return -1;
+	}
+
+	FILE *control = fdopen(control_fd, "r");
+	if (control == NULL)
+	{
+		perror("fdopen");
+		return -1;
+	}
+
+	char *line = NULL;
+	size_t line_size = 0;
+	int runs = 0;
+	double total_startup_us = 0;
+	struct timespec server_start, run_start, run_ready, run_end;
+	clock_gettime(CLOCK_MONOTONIC, &server_start);
+	while (getline(&line, &line_size, control) >= 0)
+	{
+		if (!at_main && line[strspn(line, " \t\n")] != '\0')
+		{
+			prf_printf("fork-server: arguments need --stop-at main, run skipped\n");
+			continue;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &run_start);
+		const unsigned long no_args[6] = {0};
+		unsigned long child = 0;
+		inject_syscall(template_pid, SYS_fork, no_args, &child);
+		if (child == 0)
+		{
+			prf_printf("fork-server: fork failed\n");
+			break;
+		}
+
+		// the copy starts inside the injected syscall, put it back at the stop point
+		waitpid((pid_t)child, &wait_status, __WALL);
+		ptrace(PTRACE_SETOPTIONS, (pid_t)child, NULL, (void *)PTRACE_O_EXITKILL);
+		ptrace(PTRACE_POKETEXT, (pid_t)child, (void *)regs.rip, (void *)ptrace(PTRACE_PEEKTEXT, template_pid, (void *)regs.rip, NULL));
+		struct user_regs_struct child_regs = regs;
+		if (at_main)
+		{
+			int argc = write_run_args((pid_t)child, arena_addr, exe_file_name, line);
+			if (argc < 0)
+			{
+				prf_printf("fork-server: arguments too long, run skipped\n");
+				kill((pid_t)child, SIGKILL);
+				waitpid((pid_t)child, &wait_status, __WALL);
+				continue;
+			}
+			child_regs.rdi = argc;
+			child_regs.rsi = arena_addr;
+		}
+		ptrace(PTRACE_SETREGS, (pid_t)child, NULL, &child_regs);
+		clock_gettime(CLOCK_MONOTONIC, &run_ready);
+
+		trace_calls((pid_t)child, addr, got_addr, entry_data, where);
+		clock_gettime(CLOCK_MONOTONIC, &run_end);
+
+		// reap the zombie, its parent is the stopped template
+		const unsigned long wait_args[6] = {child, 0, WNOHANG, 0};
+		inject_syscall(template_pid, SYS_wait4, wait_args, NULL);
+
+		runs++;
+		double startup_us = elapsed_us(&run_start, &run_ready);
+		total_startup_us += startup_us;
+		prf_printf("fork-server run %d: startup %.1f us, total %.1f us\n", runs, startup_us, elapsed_us(&run_start, &run_end));
+		fflush(stdout);
+	}
+	free(line);
+
+	struct timespec server_end;
+	clock_gettime(CLOCK_MONOTONIC, &server_end);
+	double total_s = elapsed_us(&server_start, &server_end) / 1e6;
+	if (runs > 0)
+		prf_printf("fork-server: %d runs in %.3f s (%.1f runs/sec), mean startup %.1f us\n",
+				   runs, total_s, runs / total_s, total_startup_us / runs);
+
+	kill(template_pid, SIGKILL);
+	waitpid(template_pid, &wait_status, __WALL);
+	return 0;
+}
+
+// Set on SIGINT or SIGTERM, the shards then leave their targets and return.
+// SIGUSR1 gets them out of waitpid to see it.
+static volatile sig_atomic_t stop_requested;
+
+void wake_shard(int sig)
+{
+	(void)sig;
+}
+
+// a tracer thread and the targets it owns, ptrace only works from the thread
+// that launched or attached to a process
+struct tracer_shard
+{
+	pthread_t thread;
+	int cpu;
+	const struct prf_options *opts;
+	int ntargets;
+	int capacity;
+	struct target **targets;
+	char *const *target_args; // command line of launched targets
+	char **symbols;			  // traced in every target, when present in its image
+	int nsymbols;
+	int tracee_cpu; // with opts->pin, where the targets are pinned
+	int failed;	 // launched targets that exited before their exec
+	int done_fd; // eventfd counting the shards that returned
+	// stop latency, each target measured on its own: waitpid return to resume
+	// less the single steps, the steps, and resume to the target's next stop
+	long stops;
+	double stop_to_resume_us;
+	long steps;
+	double step_us;
+	long resumed_stops; // stops that had a resume of the same target before them
+	double resume_to_stop_us;
+};
+
+// Append a new target to the shard and return its index
+int shard_add_target(struct tracer_shard *shard)
+{
+	if (shard->ntargets == shard->capacity)
+	{
+		shard->capacity = shard->capacity ? shard->capacity * 2 : 8;
+		shard->targets = realloc(shard->targets, shard->capacity * sizeof(struct target *));
+	}
+	struct target *t = calloc(1, sizeof(struct target));
+	t->parent = -1;
+	t->syscall_idx = -1;
+	shard->targets[shard->ntargets] = t;
+	return shard->ntargets++;
+}
+
+// Index of the live target with the given pid, -1 if there is none
+int shard_find_target(struct tracer_shard *shard, pid_t pid)
+{
+	for (int i = 0; i < shard->ntargets; i++)
+	{
+		if (shard->targets[i]->pid == pid && !shard->targets[i]->exited)
+			return i;
+	}
+	return -1;
+}
+
+// The target at parent forked child. Returns the change in live targets.
+int shard_on_fork(struct tracer_shard *shard, int parent, pid_t child, bool vfork)
+{
+	int wait_status;
+	int idx = shard_find_target(shard, child);
+	bool was_pending = idx >= 0;
+	if (!was_pending)
+		wait_tracee(child, &wait_status); // its initial SIGSTOP
+
+	if (!shard->opts->follow)
+	{
+		target_release_child(shard->targets[parent], child, vfork);
+		if (was_pending)
+			shard->targets[idx]->exited = true;
+		return was_pending ? -1 : 0;
+	}
+
+	if (!was_pending)
+		idx = shard_add_target(shard);
+	// the child has the parent's breakpoints and calls in progress
+	struct target *t = shard->targets[idx];
+	*t = *shard->targets[parent];
+	t->pid = child;
+	t->parent = parent;
+	for (int i = 0; i < t->nfuncs; i++)
+	{
+		t->funcs[i].calls = 0;
+		t->funcs[i].matched = 0;
+		t->funcs[i].counted = 0;
+		t->funcs[i].counted_stops = 0;
+		t->funcs[i].counters_bias = 0;
+		// a call in progress is counted from the fork on
+		memset(t->funcs[i].counters_start, 0, sizeof(t->funcs[i].counters_start));
+		memset(t->funcs[i].counters_total, 0, sizeof(t->funcs[i].counters_total));
+		t->funcs[i].stops_start = t->stops;
+	}
+	if (t->counters.n > 0 && counters_open(&t->counters, child) < 0)
+		t->counters.n = 0;
+	memset(t->syscalls, 0, sizeof(t->syscalls));
+	t->syscall_idx = -1;
+	target_rearm_hw(t);
+	ptrace(PTRACE_CONT, child, NULL, NULL);
+	return was_pending ? 0 : 1;
+}
+
+// The target at idx exec'd, trace the same symbols in the new image (only the
+// ones it has) as a new node of the process tree
+void shard_on_exec(struct tracer_shard *shard, int idx)
+{
+	int new_idx = shard_add_target(shard);
+	struct target *old = shard->targets[idx];
+	struct target *t = shard->targets[new_idx];
+	// a traced execve returns in the new image, it succeeded
+	target_end_syscall(old, 0);
+	old->exited = true;
+	t->pid = old->pid;
+	t->parent = idx;
+	t->print_calls = old->print_calls;
+	t->attached = old->attached;
+	t->opts = old->opts;
+	t->metrics = old->metrics;
+	t->where = old->where;
+	t->counters = old->counters;
+	old->counters.n = 0;
+	memcpy(t->stop_cost, old->stop_cost, sizeof(t->stop_cost));
+	t->stop_samples = old->stop_samples;
+	t->stacks = old->stacks;
+
+	char link[64];
+	snprintf(link, sizeof(link), "/proc/%d/exe", t->pid);
+	ssize_t len = readlink(link, t->exe, sizeof(t->exe) - 1);
+	if (len < 0)
+		return;
+	t->exe[len] = '\0';
+	strcpy(t->path, t->exe);
+	for (int i = 0; i < shard->nsymbols; i++)
+		target_add_func(t, shard->symbols[i]);
+	target_arm(t);
+}
+
+// Another hardware thread of cpu's core, cpu itself if it has none
+int sibling_cpu(int cpu)
+{
+	char path[96];
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+	FILE *fptr = fopen(path, "r");
+	if (fptr == NULL)
+		return cpu;
+	char list[256] = "";
+	if (fgets(list, sizeof(list), fptr) == NULL)
+		list[0] = '\0';
+	fclose(fptr);
+
+	// a list of ranges, e.g. "0,4" or "0-1"
+	for (char *p = list; *p != '\0' && *p != '\n';)
+	{
+		long first = strtol(p, &p, 10);
+		long last = *p == '-' ? strtol(p + 1, &p, 10) : first;
+		for (long c = first; c <= last; c++)
+		{
+			if (c != cpu)
+				return (int)c;
+		}
+		if (*p == ',')
+			p++;
+		else
+			break;
+	}
+	return cpu;
+}
+
+// Pin the tracer thread of the shard and pick where its targets run
+void shard_set_scheduling(struct tracer_shard *shard)
+{
+	const struct prf_options *opts = shard->opts;
+	if (opts->pin != PIN_NONE && shard->cpu < 0)
+		shard->cpu = sched_getcpu();
+	if (shard->cpu >= 0)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(shard->cpu, &cpus);
+		pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+	shard->tracee_cpu = shard->cpu;
+	if (opts->pin == PIN_SIBLING)
+	{
+		shard->tracee_cpu = sibling_cpu(shard->cpu);
+		if (shard->tracee_cpu == shard->cpu)
+			prf_printf("cpu %d has no sibling hardware thread, the targets share its core\n", shard->cpu);
+	}
+
+	if (opts->priority)
+	{
+		// SCHED_FIFO needs CAP_SYS_NICE, a negative nice value only RLIMIT_NICE
+		struct sched_param param = {.sched_priority = 1};
+		if (pthread_setschedparam(pthread_self(), SCHED_FIFO, &param) != 0 &&
+			setpriority(PRIO_PROCESS, gettid(), -10) < 0)
+			prf_printf("can't raise the tracer priority, it keeps the default one\n");
+	}
+}
+
+// Collect the next stop of any tracee, polling for up to opts->spin_us first
+// so a stop that comes quickly doesn't pay for a sleep and a wake-up
+pid_t shard_wait(struct tracer_shard *shard, int *wait_status)
+{
+	if (shard->opts->spin_us > 0)
+	{
+		struct timespec start, now;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		do
+		{
+			pid_t pid = waitpid(-1, wait_status, __WALL | __WNOTHREAD | WNOHANG);
+			if (pid != 0)
+				return pid;
+			clock_gettime(CLOCK_MONOTONIC, &now);
+		} while (elapsed_us(&start, &now) < shard->opts->spin_us && !stop_requested);
+	}
+	return waitpid(-1, wait_status, __WALL | __WNOTHREAD);
+}
+
+// SIGINT or SIGTERM: the attached targets go on without prf, the launched
+// ones end as they would with PTRACE_O_EXITKILL. So do children still waiting
+// for their parent's fork event, it's unknown whose breakpoints they carry.
+void shard_leave(struct tracer_shard *shard)
+{
+	for (int i = 0; i < shard->ntargets; i++)
+	{
+		struct target *t = shard->targets[i];
+		if (t->exited || t->pid <= 0)
+			continue;
+		if (t->attached && !t->pending)
+			target_detach(t);
+		else
+			kill(t->pid, SIGKILL);
+	}
+}
+
+// Start (pid == 0) or attach to every target of the shard and dispatch their
+// stops until all of them exit. Stops are collected with waitpid(-1), pidfds
+// can't be used here as they only become readable on exit, not on ptrace stops.
+void *shard_main(void *arg)
+{
+	struct tracer_shard *shard = arg;
+	shard_set_scheduling(shard);
+
+	int wait_status;
+	int live = 0;
+	long options = PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK;
+	if (shard->opts->follow)
+		options |= PTRACE_O_TRACEEXEC;
+	else // vfork children are released, but share the memory of their parent
+		options |= PTRACE_O_TRACEVFORKDONE;
+	if (shard->opts->nsyscalls > 0)
+		options |= PTRACE_O_TRACESECCOMP | PTRACE_O_TRACESYSGOOD;
+	for (int i = 0; i < shard->ntargets; i++)
+	{
+		struct target *t = shard->targets[i];
+		bool attached = t->pid != 0;
+		if (!attached)
+			t->pid = run_target(t->exe, shard->target_args, shard->opts->syscalls, shard->opts->nsyscalls);
+		// seized, a running target can be interrupted to detach from it
+		else if (ptrace(PTRACE_SEIZE, t->pid, NULL, NULL) < 0 || ptrace(PTRACE_INTERRUPT, t->pid, NULL, NULL) < 0)
+		{
+			prf_printf("can't attach to %d: %s\n", t->pid, strerror(errno));
+			t->pid = -1;
+		}
+		int waited = t->pid > 0 ? wait_tracee(t->pid, &wait_status) : -1;
+		// the seccomp filter also stops the target on the execve that starts it
+		while (waited > 0 && WIFSTOPPED(wait_status) && wait_status >> 16 == PTRACE_EVENT_SECCOMP)
+		{
+			ptrace(PTRACE_CONT, t->pid, NULL, NULL);
+			waited = wait_tracee(t->pid, &wait_status);
+		}
+		if (waited < 0 || !WIFSTOPPED(wait_status))
+		{
+			if (!attached && waited > 0)
+			{
+				fprintf(stderr, "PRF:: %s didn't start, exit status %d\n", t->exe,
+						WIFEXITED(wait_status) ? WEXITSTATUS(wait_status) : 128 + WTERMSIG(wait_status));
+				shard->failed++;
+			}
+			t->pid = -1;
+			t->exited = true;
+			continue;
+		}
+		ptrace(PTRACE_SETOPTIONS, t->pid, NULL, (void *)(attached ? options : options | PTRACE_O_EXITKILL));
+		if (shard->opts->counters && counters_open(&t->counters, t->pid) < 0)
+			prf_printf("can't open the perf counters of %d: %s\n", t->pid, strerror(errno));
+		if (shard->opts->pin != PIN_NONE)
+		{
+			// forked children inherit it
+			cpu_set_t cpus;
+			CPU_ZERO(&cpus);
+			CPU_SET(shard->tracee_cpu, &cpus);
+			sched_setaffinity(t->pid, sizeof(cpus), &cpus);
+		}
+		target_arm(t);
+		ptrace(PTRACE_CONT, t->pid, NULL, NULL);
+		live++;
+	}
+
+	struct timespec stopped, resumed;
+	while (live > 0 && !stop_requested)
+	{
+		pid_t pid = shard_wait(shard, &wait_status);
+		if (pid < 0 && errno == EINTR)
+			continue;
+		if (pid < 0)
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &stopped);
+		int idx = shard_find_target(shard, pid);
+		if (idx < 0)
+		{
+			// a new child that stopped before its parent's fork event
+			if (WIFSTOPPED(wait_status))
+			{
+				idx = shard_add_target(shard);
+				shard->targets[idx]->pid = pid;
+				shard->targets[idx]->pending = true;
+				live++;
+			}
+			continue;
+		}
+		struct target *t = shard->targets[idx];
+		if (!WIFSTOPPED(wait_status))
+		{
+			// exit and exit_group have no exit stop, the process is gone
+			target_end_syscall(t, 0);
+			counters_close(&t->counters);
+			t->exited = true;
+			live--;
+			continue;
+		}
+
+		t->stops++;
+		int sig = WSTOPSIG(wait_status);
+		int event = wait_status >> 16;
+		if (sig == SIGTRAP && (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK))
+		{
+			unsigned long child;
+			ptrace(PTRACE_GETEVENTMSG, pid, NULL, &child);
+			live += shard_on_fork(shard, idx, (pid_t)child, event == PTRACE_EVENT_VFORK);
+			sig = 0;
+		}
+		else if (sig == SIGTRAP && event == PTRACE_EVENT_EXEC)
+		{
+			shard_on_exec(shard, idx);
+			sig = 0;
+		}
+		else if (sig == SIGTRAP && event == PTRACE_EVENT_VFORK_DONE)
+		{
+			target_on_vfork_done(t);
+			sig = 0;
+		}
+		else if (sig == SIGTRAP && event == PTRACE_EVENT_SECCOMP)
+		{
+			target_on_syscall_entry(t);
+			sig = 0;
+		}
+		else if (sig == (SIGTRAP | 0x80))
+		{
+			target_on_syscall_exit(t);
+			sig = 0;
+		}
+		else if (event == PTRACE_EVENT_STOP)
+		{
+			// a group stop of a seized target, which PTRACE_CONT ends
+			sig = 0;
+		}
+		else if (sig == SIGTRAP)
+		{
+			sig = 0;
+			target_on_trap(t);
+		}
+		// a fork event comes between the seccomp and exit stops of the fork
+		ptrace(t->syscall_idx >= 0 ? PTRACE_SYSCALL : PTRACE_CONT, pid, NULL, (void *)(long)sig);
+
+		clock_gettime(CLOCK_MONOTONIC, &resumed);
+		// from this target's own last resume, so other targets' stops don't land in it
+		if (t->resumed.tv_sec != 0)
+		{
+			shard->resume_to_stop_us += elapsed_us(&t->resumed, &stopped);
+			shard->resumed_stops++;
+		}
+		t->resumed = resumed;
+		shard->stop_to_resume_us += elapsed_us(&stopped, &resumed) - t->step_us;
+		shard->steps += t->steps;
+		shard->step_us += t->step_us;
+		t->steps = 0;
+		t->step_us = 0;
+		shard->stops++;
+	}
+	if (stop_requested)
+		shard_leave(shard);
+	uint64_t one = 1;
+	if (write(shard->done_fd, &one, sizeof(one)) < 0)
+		perror("eventfd");
+	return NULL;
+}
+
+// calls made by the target at idx and all of its descendants
+long shard_subtree_calls(struct tracer_shard *shard, int idx)
+{
+	long calls = 0;
+	for (int i = 0; i < shard->targets[idx]->nfuncs; i++)
+		calls += shard->targets[idx]->funcs[i].calls;
+	for (int i = idx + 1; i < shard->ntargets; i++)
+	{
+		if (shard->targets[i]->parent == idx)
+			calls += shard_subtree_calls(shard, i);
+	}
+	return calls;
+}
+
+// Print the process tree below the target at idx, one process per line
+void shard_print_tree(struct tracer_shard *shard, int idx, int depth)
+{
+	struct target *t = shard->targets[idx];
+	bool is_exec = t->parent >= 0 && shard->targets[t->parent]->pid == t->pid;
+	printf("PRF:: %*s%d %s%s", depth * 2, "", t->pid, is_exec ? "exec " : "", t->exe);
+	for (int i = 0; i < t->nfuncs; i++)
+		printf(" %s=%ld", t->funcs[i].name, t->funcs[i].calls);
+	printf(" (%ld calls in tree)\n", shard_subtree_calls(shard, idx));
+
+	for (int i = idx + 1; i < shard->ntargets; i++)
+	{
+		if (shard->targets[i]->parent == idx)
+			shard_print_tree(shard, i, depth + 1);
+	}
+}
+
+// Trace the comma separated symbols in opts->jobs copies of target_args and in
+// the opts->attach_pids processes, sharded over opts->nthreads tracer threads
+// pinned to cores. Prints the calls aggregated per binary and symbol, and with
+// opts->follow the process trees including forked children and exec'd images.
+int multi_trace(char *symbols, char *const target_args[], const struct prf_options *opts)
+{
+	int jobs = opts->jobs;
+	int nthreads = opts->nthreads;
+	int ntargets = jobs + opts->nattach;
+	if (nthreads < 1)
+		nthreads = 1;
+	if (nthreads > ntargets)
+		nthreads = ntargets;
+	char *names[MAX_TRACED_FUNCS];
+	int nnames = 0;
+	char *save = NULL;
+	for (char *name = strtok_r(symbols, ",", &save); name != NULL && nnames < MAX_TRACED_FUNCS; name = strtok_r(NULL, ",", &save))
+		names[nnames++] = name;
+
+	static struct metrics metrics;
+	if (opts->metrics_name != NULL && metrics_open(&metrics, opts->metrics_name) < 0)
+		return -1;
+	static struct stack_trie stacks;
+	if (opts->stacks_file != NULL)
+		stack_trie_init(&stacks);
+
+	long ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	struct tracer_shard *shards = calloc(nthreads, sizeof(struct tracer_shard));
+	for (int i = 0; i < nthreads; i++)
+	{
+		shards[i].cpu = nthreads > 1 ? (int)(i % ncpus) : -1;
+		shards[i].opts = opts;
+		shards[i].target_args = target_args;
+		shards[i].symbols = names;
+		shards[i].nsymbols = nnames;
+	}
+
+	for (int i = 0; i < ntargets; i++)
+	{
+		struct tracer_shard *shard = &shards[i * nthreads / ntargets];
+		int idx = shard_add_target(shard);
+		struct target *t = shard->targets[idx];
+		t->opts = opts;
+		t->metrics = opts->metrics_name ? &metrics : NULL;
+		t->where = opts->where;
+		t->stacks = opts->stacks_file ? &stacks : NULL;
+		if (i < jobs)
+		{
+			strncpy(t->exe, target_args[0], sizeof(t->exe) - 1);
+			if (realpath(t->exe, t->path) == NULL)
+				strcpy(t->path, t->exe);
+		}
+		else
+		{
+			t->pid = opts->attach_pids[i - jobs];
+			t->attached = true;
+			// other threads would die on the breakpoints, only the traced one stops at them
+			char task_path[64];
+			snprintf(task_path, sizeof(task_path), "/proc/%d/task", t->pid);
+			int nthreads_of = 0;
+			DIR *tasks = opendir(task_path);
+			for (struct dirent *d; tasks != NULL && (d = readdir(tasks)) != NULL;)
+				nthreads_of += d->d_name[0] != '.';
+			if (tasks != NULL)
+				closedir(tasks);
+			if (nthreads_of > 1)
+			{
+				prf_printf("%d has %d threads, only single-threaded processes can be attached\n", t->pid, nthreads_of);
+				t->pid = -1;
+				continue;
+			}
+			char link[64];
+			snprintf(link, sizeof(link), "/proc/%d/exe", t->pid);
+			ssize_t len = readlink(link, t->exe, sizeof(t->exe) - 1);
+			if (len < 0)
+			{
+				prf_printf("can't find the executable of %d\n", t->pid);
+				t->pid = -1;
+				continue;
+			}
+			t->exe[len] = '\0';
+			strcpy(t->path, t->exe);
+		}
+
+		for (int j = 0; j < nnames; j++)
+		{
+			if (target_add_func(t, names[j]) <= 0 && (i == 0 || i >= jobs))
+				prf_printf("%s can't be traced in %s\n", names[j], t->exe);
+		}
+	}
+
+	// SIGINT and SIGTERM come through a signalfd here, blocked in every thread,
+	// and the shards are told to leave their targets
+	sigset_t stop_signals, old_mask;
+	sigemptyset(&stop_signals);
+	sigaddset(&stop_signals, SIGINT);
+	sigaddset(&stop_signals, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &stop_signals, &old_mask);
+	struct sigaction wake = {.sa_handler = wake_shard}; // no SA_RESTART, waitpid fails with EINTR
+	sigaction(SIGUSR1, &wake, NULL);
+	int signal_fd = signalfd(-1, &stop_signals, SFD_CLOEXEC);
+	int done_fd = eventfd(0, EFD_CLOEXEC);
+	for (int i = 0; i < nthreads; i++)
+	{
+		shards[i].done_fd = done_fd;
+		pthread_create(&shards[i].thread, NULL, shard_main, &shards[i]);
+	}
+	for (int finished = 0; finished < nthreads;)
+	{
+		struct pollfd fds[2] = {{.fd = done_fd, .events = POLLIN}, {.fd = signal_fd, .events = POLLIN}};
+		// once stopping, wake the shards again in case one was about to enter waitpid
+		poll(fds, 2, stop_requested ? 10 : -1);
+		uint64_t n;
+		if ((fds[0].revents & POLLIN) && read(done_fd, &n, sizeof(n)) == sizeof(n))
+			finished += (int)n;
+		struct signalfd_siginfo info;
+		if ((fds[1].revents & POLLIN) && read(signal_fd, &info, sizeof(info)) == sizeof(info))
+			stop_requested = 1;
+		for (int i = 0; i < nthreads && stop_requested && finished < nthreads; i++)
+			pthread_kill(shards[i].thread, SIGUSR1);
+	}
+	int failed = 0;
+	for (int i = 0; i < nthreads; i++)
+	{
+		pthread_join(shards[i].thread, NULL);
+		failed += shards[i].failed;
+	}
+	close(signal_fd);
+	close(done_fd);
+	pthread_sigmask(SIG_SETMASK, &old_mask, NULL);
+
+	// aggregate per binary and symbol
+	int ntotal = 0;
+	for (int i = 0; i < nthreads; i++)
+		ntotal += shards[i].ntargets;
+	struct target **all = calloc(ntotal, sizeof(struct target *));
+	for (int i = 0, n = 0; i < nthreads; i++)
+	{
+		memcpy(all + n, shards[i].targets, shards[i].ntargets * sizeof(struct target *));
+		n += shards[i].ntargets;
+	}
+	bool *reported = calloc(ntotal * MAX_TRACED_FUNCS, sizeof(bool));
+	for (int i = 0; i < ntotal; i++)
+	{
+		for (int j = 0; j < all[i]->nfuncs; j++)
+		{
+			if (reported[i * MAX_TRACED_FUNCS + j])
+				continue;
+			const char *name = all[i]->funcs[j].name;
+			long calls = 0, matched = 0, counted = 0, counted_stops = 0;
+			unsigned long long counters[NCOUNTERS] = {0}, bias = 0;
+			int processes = 0;
+			for (int k = i; k < ntotal; k++)
+			{
+				if (strcmp(all[k]->path, all[i]->path) != 0)
+					continue;
+				// a process that exec'd the same binary again is still one process
+				bool seen = false;
+				for (int m = i; m < k && !seen; m++)
+					seen = all[m]->pid == all[k]->pid && strcmp(all[m]->path, all[k]->path) == 0;
+				for (int l = 0; l < all[k]->nfuncs; l++)
+				{
+					if (strcmp(all[k]->funcs[l].name, name) == 0)
+					{
+						calls += all[k]->funcs[l].calls;
+						matched += all[k]->funcs[l].matched;
+						counted += all[k]->funcs[l].counted;
+						counted_stops += all[k]->funcs[l].counted_stops;
+						bias += all[k]->funcs[l].counters_bias;
+						for (int c = 0; c < NCOUNTERS; c++)
+							counters[c] += all[k]->funcs[l].counters_total[c];
+						processes += all[k]->pid > 0 && !seen;
+						reported[k * MAX_TRACED_FUNCS + l] = true;
+					}
+				}
+			}
+			if (opts->where != NULL)
+				prf_printf("%s %s: %ld calls in %d processes, %ld matching --where\n", all[i]->exe, name, calls, processes, matched);
+			else
+				prf_printf("%s %s: %ld calls in %d processes\n", all[i]->exe, name, calls, processes);
+			if (counted > 0)
+			{
+				prf_printf("%s %s: %.2f us on cpu, %.2f page faults, %.2f context switches per call",
+						   all[i]->exe, name, counters[COUNTER_TASK_CLOCK] / 1e3 / counted,
+						   (double)counters[COUNTER_PAGE_FAULTS] / counted, (double)counters[COUNTER_CONTEXT_SWITCHES] / counted);
+				if (counters[COUNTER_CYCLES] > 0)
+					printf(", %.0f instructions in %.0f cycles", (double)counters[COUNTER_INSTRUCTIONS] / counted,
+						   (double)counters[COUNTER_CYCLES] / counted);
+				printf("\n");
+				prf_printf("%s %s: less %.2f us on cpu for the %.2f stops of prf per call\n", all[i]->exe, name,
+						   bias / 1e3 / counted, (double)counted_stops / counted);
+			}
+		}
+	}
+
+	// syscalls per binary, from the first process that ran it
+	for (int i = 0; i < ntotal && opts->nsyscalls > 0; i++)
+	{
+		bool seen = false;
+		for (int k = 0; k < i && !seen; k++)
+			seen = strcmp(all[k]->path, all[i]->path) == 0;
+		if (seen || all[i]->pid <= 0)
+			continue;
+		for (int j = 0; j < opts->nsyscalls; j++)
+		{
+			struct syscall_stats sum = {0};
+			for (int k = i; k < ntotal; k++)
+			{
+				if (strcmp(all[k]->path, all[i]->path) != 0)
+					continue;
+				sum.calls += all[k]->syscalls[j].calls;
+				sum.failed += all[k]->syscalls[j].failed;
+				sum.latency_ns += all[k]->syscalls[j].latency_ns;
+				for (int e = 0; e < MAX_ERRNO; e++)
+					sum.errors[e] += all[k]->syscalls[j].errors[e];
+			}
+			const char *name = syscall_name(opts->syscalls[j]);
+			char nr[16];
+			snprintf(nr, sizeof(nr), "syscall %d", opts->syscalls[j]);
+			prf_printf("%s %s: %ld calls, %ld failed, %.1f us mean latency", all[i]->exe, name ? name : nr,
+					   sum.calls, sum.failed, sum.calls ? sum.latency_ns / 1e3 / sum.calls : 0.0);
+			for (int e = 1; e < MAX_ERRNO; e++)
+			{
+				if (sum.errors[e] > 0)
+					printf(" %s=%ld", strerrorname_np(e) ? strerrorname_np(e) : "?", sum.errors[e]);
+			}
+			printf("\n");
+		}
+	}
+
+	if (opts->follow)
+	{
+		prf_printf("process tree:\n");
+		for (int i = 0; i < nthreads; i++)
+		{
+			for (int j = 0; j < shards[i].ntargets; j++)
+			{
+				if (shards[i].targets[j]->parent < 0 && shards[i].targets[j]->pid > 0)
+					shard_print_tree(&shards[i], j, 0);
+			}
+		}
+	}
+
+	if (opts->stacks_file != NULL && stack_trie_write(&stacks, opts->stacks_file) == 0)
+		prf_printf("%ld stacks (%d frames, %ld cut short) written to %s\n", stacks.captured, stacks.nnodes, stacks.truncated, opts->stacks_file);
+
+	long stops = 0, steps = 0, resumed_stops = 0;
+	double stop_to_resume_us = 0, step_us = 0, resume_to_stop_us = 0;
+	for (int i = 0; i < nthreads; i++)
+	{
+		stops += shards[i].stops;
+		stop_to_resume_us += shards[i].stop_to_resume_us;
+		steps += shards[i].steps;
+		step_us += shards[i].step_us;
+		resumed_stops += shards[i].resumed_stops;
+		resume_to_stop_us += shards[i].resume_to_stop_us;
+	}
+	// handling is the tracer's own work on a stop, a step the round trip of a
+	// single step over a breakpoint, and running the target's time from its
+	// resume to its next stop
+	if (stops > 0)
+		prf_printf("%ld stops, %.0f ns handling, %ld steps of %.0f ns, %.0f ns running\n", stops,
+				   stop_to_resume_us * 1e3 / stops, steps, steps > 0 ? step_us * 1e3 / steps : 0,
+				   resumed_stops > 0 ? resume_to_stop_us * 1e3 / resumed_stops : 0);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	prf_printf("tracer cpu %.3f s user, %.3f s system, %d threads\n",
+			   usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+			   usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6, nthreads);
+	if (opts->metrics_name != NULL)
+		metrics_close(&metrics);
+	for (int i = 0; i < ntotal; i++)
+		free(all[i]);
+	for (int i = 0; i < nthreads; i++)
+		free(shards[i].targets);
+	free(reported);
+	free(all);
+	free(shards);
+	return failed > 0 ? -1 : 0;
+}
+
+// a function entry armed by the coverage mode
+struct cov_entry
+{
+	unsigned long addr;
+	int func; // bit of the function in the coverage bitmap
+	int run;  // text run holding addr
+	bool hit;
+};
+
+// consecutive text pages holding armed entries, written in one go
+struct cov_run
+{
+	unsigned long start;
+	size_t len;
+	unsigned char *orig;
+};
+
+int cov_entry_cmp(const void *a, const void *b)
+{
+	unsigned long addr_a = ((const struct cov_entry *)a)->addr;
+	unsigned long addr_b = ((const struct cov_entry *)b)->addr;
+	return addr_a < addr_b ? -1 : addr_a > addr_b;
+}
+
+// Write the text runs into the process behind mem_fd, with an int3 on every
+// entry that wasn't hit yet when armed is set, or as they originally were
+void cov_write_runs(int mem_fd, struct cov_run *runs, int nruns, struct cov_entry *entries, int nentries, bool armed)
+{
+	for (int r = 0, e = 0; r < nruns; r++)
+	{
+		unsigned char *text = runs[r].orig;
+		if (armed)
+		{
+			text = malloc(runs[r].len);
+			memcpy(text, runs[r].orig, runs[r].len);
+			for (; e < nentries && entries[e].run == r; e++)
+			{
+				if (!entries[e].hit)
+					text[entries[e].addr - runs[r].start] = 0xcc;
+			}
+		}
+		pwrite(mem_fd, text, runs[r].len, runs[r].start);
+		if (armed)
+			free(text);
+	}
+}
+
+// Function coverage of a whole executable: arm a one-shot breakpoint on every
+// STT_FUNC symbol of .symtab, and on the first hit restore the original byte for
+// good. Bit i of the bitmap written to out_file (LSB first) is set if the i-th
+// defined function of .symtab ran.
+int coverage(char *const target_args[], const char *out_file)
+{
+	char *exe_file_name = target_args[0];
+	struct symbol_index *index = get_symbol_index(exe_file_name);
+	if (!symbol_index_traceable(index))
+	{
+		prf_printf("%s not an executable! :(\n", exe_file_name);
+		return -1;
+	}
+
+	struct cov_entry *entries = calloc(index->symtab_count + 1, sizeof(struct cov_entry));
+	int nentries = 0;
+	for (size_t i = 0; i < index->symtab_count; i++)
+	{
+		Elf64_Sym *sym = &index->symtab[i];
+		if (ELF64_ST_TYPE(sym->st_info) == STT_FUNC && sym->st_shndx != SHN_UNDEF && sym->st_value != 0)
+		{
+			entries[nentries].addr = sym->st_value;
+			entries[nentries].func = nentries;
+			nentries++;
+		}
+	}
+	int nfuncs = nentries;
+	qsort(entries, nentries, sizeof(struct cov_entry), cov_entry_cmp);
+
+	pid_t pid = run_target(exe_file_name, target_args, NULL, 0);
+	int wait_status;
+	if (pid <= 0 || waitpid(pid, &wait_status, __WALL) < 0 || !WIFSTOPPED(wait_status))
+		return -1;
+	ptrace(PTRACE_SETOPTIONS, pid, NULL, (void *)(PTRACE_O_TRACEFORK | PTRACE_O_TRACEVFORK | PTRACE_O_TRACEEXEC | PTRACE_O_EXITKILL));
+
+	struct timespec arm_start, arm_end;
+	clock_gettime(CLOCK_MONOTONIC, &arm_start);
+	char mem_path[64];
+	snprintf(mem_path, sizeof(mem_path), "/proc/%d/mem", pid);
+	int mem_fd = open(mem_path, O_RDWR);
+
+	// group the entries into runs of consecutive pages and read them
+	struct cov_run *runs = calloc(nentries + 1, sizeof(struct cov_run));
+	int nruns = 0;
+	for (int i = 0; i < nentries; i++)
+	{
+		unsigned long page = entries[i].addr & PAGE_MASK;
+		struct cov_run *run = &runs[nruns - 1];
+		if (nruns == 0 || page > run->start + run->len)
+		{
+			run = &runs[nruns++];
+			run->start = page;
+			run->len = 0;
+		}
+		if (page == run->start + run->len)
+			run->len += PAGE_SIZE;
+		entries[i].run = nruns - 1;
+	}
+	for (int r = 0; r < nruns; r++)
+	{
+		runs[r].orig = malloc(runs[r].len);
+		if (pread(mem_fd, runs[r].orig, runs[r].len, runs[r].start) != (ssize_t)runs[r].len)
+		{
+			// not mapped as a whole, leave these entries alone
+			for (int i = 0; i < nentries; i++)
+				entries[i].hit |= entries[i].run == r;
+			memset(runs[r].orig, 0, runs[r].len);
+			runs[r].len = 0;
+		}
+	}
+	cov_write_runs(mem_fd, runs, nruns, entries, nentries, true);
+	clock_gettime(CLOCK_MONOTONIC, &arm_end);
+
+	unsigned char *bitmap = calloc((nfuncs + 7) / 8, 1);
+	long traps = 0;
+	int hit_funcs = 0;
+	ptrace(PTRACE_CONT, pid, NULL, NULL);
+	waitpid(pid, &wait_status, __WALL);
+	while (WIFSTOPPED(wait_status))
+	{
+		int sig = WSTOPSIG(wait_status);
+		int event = wait_status >> 16;
+		if (sig == SIGTRAP && (event == PTRACE_EVENT_FORK || event == PTRACE_EVENT_VFORK))
+		{
+			// children aren't covered, give them back the original text
+			unsigned long child;
+			ptrace(PTRACE_GETEVENTMSG, pid, NULL, &child);
+			waitpid((pid_t)child, &wait_status, __WALL);
+			if (event == PTRACE_EVENT_FORK)
+			{
+				snprintf(mem_path, sizeof(mem_path), "/proc/%lu/mem", child);
+				int child_fd = open(mem_path, O_RDWR);
+				cov_write_runs(child_fd, runs, nruns, entries, nentries, false);
+				close(child_fd);
+			}
+			ptrace(PTRACE_DETACH, (pid_t)child, NULL, NULL);
+			sig = 0;
+		}
+		else if (sig == SIGTRAP && event == PTRACE_EVENT_EXEC)
+		{
+			// a new image, nothing armed is left to see
+			ptrace(PTRACE_DETACH, pid, NULL, NULL);
+			waitpid(pid, &wait_status, 0);
+			break;
+		}
+		else if (sig == SIGTRAP)
+		{
+			struct user_regs_struct regs;
+			ptrace(PTRACE_GETREGS, pid, NULL, &regs);
+			struct cov_entry key = {.addr = regs.rip - 1};
+			struct cov_entry *entry = bsearch(&key, entries, nentries, sizeof(struct cov_entry), cov_entry_cmp);
+			if (entry != NULL && !entry->hit)
+			{
+				// aliases share the address, bsearch may land on any of them
+				while (entry > entries && entry[-1].addr == key.addr)
+					entry--;
+				struct cov_run *run = &runs[entry->run];
+				pwrite(mem_fd, &run->orig[key.addr - run->start], 1, key.addr);
+				for (; entry < entries + nentries && entry->addr == key.addr; entry++)
+				{
+					entry->hit = true;
+					bitmap[entry->func / 8] |= 1 << (entry->func % 8);
+					hit_funcs++;
+				}
+				regs.rip = key.addr;
+				ptrace(PTRACE_SETREGS, pid, NULL, &regs);
+				traps++;
+				sig = 0;
+			}
+		}
+		ptrace(PTRACE_CONT, pid, NULL, (void *)(long)sig);
+		waitpid(pid, &wait_status, __WALL);
+	}
+	close(mem_fd);
+
+	FILE *out = fopen(out_file, "w");
+	if (out == NULL || fwrite(bitmap, (nfuncs + 7) / 8, 1, out) != 1)
+		perror(out_file);
+	if (out != NULL)
+		fclose(out);
+	prf_printf("coverage: %d of %d functions hit, armed in %.1f us, %ld traps, bitmap written to %s\n",
+			   hit_funcs, nfuncs, elapsed_us(&arm_start, &arm_end), traps, out_file);
+
+	for (int r = 0; r < nruns; r++)
+		free(runs[r].orig);
+	free(runs);
+	free(entries);
+	free(bitmap);
+	return 0;
+}
+
+// Shared memory of the LD_AUDIT library for a run of prf, named after mode
+// into shm_name. audit_lib is resolved to an absolute path in lib_path: ld.so
+// only warns about a library it can't load and runs the target unaudited.
+struct audit_shared *audit_open(const char *mode, const char *audit_lib, char *shm_name, size_t shm_name_len,
+								char *lib_path)
+{
+	if (realpath(audit_lib, lib_path) == NULL)
+	{
+		perror(audit_lib);
+		return NULL;
+	}
+	snprintf(shm_name, shm_name_len, "/prf-%s-%d", mode, getpid());
+	int shm_fd = shm_open(shm_name, O_CREAT | O_RDWR | O_TRUNC, 0600);
+	if (shm_fd < 0 || ftruncate(shm_fd, sizeof(struct audit_shared)) < 0)
+	{
+		perror("shm_open");
+		return NULL;
+	}
+	struct audit_shared *shared = mmap(NULL, sizeof(struct audit_shared), PROT_READ | PROT_WRITE, MAP_SHARED, shm_fd, 0);
+	close(shm_fd);
+	if (shared == MAP_FAILED)
+	{
+		perror("mmap");
+		shm_unlink(shm_name);
+		return NULL;
+	}
+	return shared;
+}
+
+void audit_close(struct audit_shared *shared, const char *shm_name)
+{
+	munmap(shared, sizeof(struct audit_shared));
+	shm_unlink(shm_name);
+}
+
+// Start the target with the audit library loaded, pointed at shm_name
+pid_t audit_run_target(char *const target_args[], const char *lib_path, const char *shm_name)
+{
+	pid_t pid = fork();
+	if (pid == 0)
+	{
+		setenv("LD_AUDIT", lib_path, 1);
+		setenv(PRF_AUDIT_SHM_ENV, shm_name, 1);
+		execv(target_args[0], target_args);
+		perror("execv");
+		exit(1);
+	}
+	if (pid < 0)
+		perror("fork");
+	return pid;
+}
+
+// Process the queued events with on_event, returns how many there were
+long audit_drain(struct audit_shared *shared, void (*on_event)(void *arg, const struct audit_event *e), void *arg)
+{
+	long n = 0;
+	unsigned long tail = shared->ring_tail;
+	for (;; tail++, n++)
+	{
+		struct audit_event *e = &shared->ring[tail & (AUDIT_RING - 1)];
+		if (__atomic_load_n(&e->seq, __ATOMIC_ACQUIRE) != tail + 1)
+			break;
+		on_event(arg, e);
+		// hand the slot back every so often, not for every event
+		if ((tail & 1023) == 1023)
+			__atomic_store_n(&shared->ring_tail, tail + 1, __ATOMIC_RELEASE);
+	}
+	__atomic_store_n(&shared->ring_tail, tail, __ATOMIC_RELEASE);
+	return n;
+}
+
+// Drain the events in batches while the target pid runs, then what it left in
+// the ring. Returns how many events were lost.
+unsigned long audit_wait_target(struct audit_shared *shared, pid_t pid,
+								void (*on_event)(void *arg, const struct audit_event *e), void *arg)
+{
+	int wait_status;
+	bool exited = pid < 0;
+	while (!exited)
+	{
+		if (audit_drain(shared, on_event, arg) == 0)
+		{
+			exited = waitpid(pid, &wait_status, WNOHANG) != 0;
+			if (!exited)
+				usleep(200);
+		}
+		else // next to the output of the target
+			fflush(stdout);
+	}
+	// processes it left behind must not wait on the ring for us from now on
+	__atomic_store_n(&shared->consumer_gone, 1, __ATOMIC_RELEASE);
+	audit_drain(shared, on_event, arg);
+	fflush(stdout);
+	// calls reserved in the ring but never written, by a process that died in
+	// between or is still writing, and the calls dropped while it was full
+	return __atomic_load_n(&shared->ring_head, __ATOMIC_ACQUIRE) - shared->ring_tail +
+		   __atomic_load_n(&shared->dropped, __ATOMIC_RELAXED);
+}
+
+// --audit output, numbered per function like the breakpoints number them
+struct audit_returns
+{
+	const struct audit_shared *shared;
+	long calls[AUDIT_MAX_FUNCS];
+};
+
+void audit_on_return(void *arg, const struct audit_event *e)
+{
+	struct audit_returns *returns = arg;
+	long run = ++returns->calls[e->func];
+	if (returns->shared->nfuncs > 1)
+		prf_printf("%s run #%ld returned with %d\n", returns->shared->funcs[e->func].name, run, (int)e->ptr);
+	else
+		prf_printf("run #%ld returned with %d\n", run, (int)e->ptr);
+}
+
+// Count calls to the comma separated imported functions without ptrace: the
+// target runs with the LD_AUDIT library audit_lib, which counts them from
+// la_pltenter/la_pltexit and queues their return values in shared memory.
+// The output is the same as tracing with breakpoints, named after the function
+// when there are several.
+int audit_trace(char *symbols, char *const target_args[], const char *audit_lib)
+{
+	char *exe_file_name = target_args[0];
+	char shm_name[64], lib_path[PATH_MAX];
+	struct audit_shared *shared = audit_open("audit", audit_lib, shm_name, sizeof(shm_name), lib_path);
+	if (shared == NULL)
+		return -1;
+
+	char *save = NULL;
+	for (char *name = strtok_r(symbols, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save))
+	{
+		int err = 0;
+		find_symbol(name, exe_file_name, &err);
+		if (err == -3)
+		{
+			prf_printf("%s not an executable! :(\n", exe_file_name);
+			break;
+		}
+		if (err != 2)
+			prf_printf("%s isn't imported from a shared library, --audit can't trace it\n", name);
+		else if (shared->nfuncs < AUDIT_MAX_FUNCS)
+			strncpy(shared->funcs[shared->nfuncs++].name, name, sizeof(shared->funcs[0].name) - 1);
+	}
+
+	int ret = 0;
+	pid_t pid = shared->nfuncs > 0 ? audit_run_target(target_args, lib_path, shm_name) : -1;
+	if (pid > 0)
+	{
+		struct audit_returns returns = {.shared = shared};
+		unsigned long lost = audit_wait_target(shared, pid, audit_on_return, &returns);
+		if (lost > 0)
+			prf_printf("%lu returns were lost, the ring was full or a process left it\n", lost);
+	}
+	else
+	{
+		ret = -1;
+	}
+
+	audit_close(shared, shm_name);
+	return ret;
+}
+
+// a live block of the --alloc heap table
+struct alloc_block
+{
+	unsigned long ptr; // 0 if the slot is free
+	unsigned long size;
+	int site;
+};
+
+// allocations made from one call site
+struct alloc_site
+{
+	unsigned long addr;
+	long calls;
+	unsigned long bytes;
+	long live_blocks;
+	unsigned long live_bytes;
+};
+
+// The target's heap as seen through its allocator calls. Blocks and sites are
+// in open addressing tables with linear probing, grown at half full.
+struct alloc_table
+{
+	struct alloc_block *blocks;
+	size_t blocks_cap;
+	size_t nblocks;
+	struct alloc_site *sites; // in order of first call
+	int nsites;
+	int *site_slots; // index in sites, -1 if free
+	size_t site_slots_cap;
+	long calls[AUDIT_NALLOC_FUNCS];
+	unsigned long bytes;
+	unsigned long live_bytes;
+	unsigned long peak_bytes;
+	long unknown_frees; // of blocks allocated before the audit or by libc itself
+	long missed_frees;	// blocks returned again while live, freed by libc itself
+};
+
+size_t alloc_hash(unsigned long key, size_t cap)
+{
+	return (size_t)((key >> 4) * 0x9e3779b97f4a7c15UL) & (cap - 1);
+}
+
+int alloc_site_index(struct alloc_table *table, unsigned long addr)
+{
+	if ((size_t)table->nsites * 2 >= table->site_slots_cap)
+	{
+		free(table->site_slots);
+		table->site_slots_cap = table->site_slots_cap ? table->site_slots_cap * 2 : 256;
+		table->site_slots = malloc(table->site_slots_cap * sizeof(int));
+		memset(table->site_slots, 0xff, table->site_slots_cap * sizeof(int));
+		table->sites = realloc(table->sites, table->site_slots_cap / 2 * sizeof(struct alloc_site));
+		for (int i = 0; i < table->nsites; i++)
+		{
+			size_t slot = alloc_hash(table->sites[i].addr, table->site_slots_cap);
+			while (table->site_slots[slot] >= 0)
+				slot = (slot + 1) & (table->site_slots_cap - 1);
+			table->site_slots[slot] = i;
+		}
+	}
+	size_t slot = alloc_hash(addr, table->site_slots_cap);
+	while (table->site_slots[slot] >= 0)
+	{
+		if (table->sites[table->site_slots[slot]].addr == addr)
+			return table->site_slots[slot];
+		slot = (slot + 1) & (table->site_slots_cap - 1);
+	}
+	struct alloc_site *site = &table->sites[table->nsites];
+	memset(site, 0, sizeof(*site));
+	site->addr = addr;
+	table->site_slots[slot] = table->nsites;
+	return table->nsites++;
+}
+
+void alloc_insert(struct alloc_table *table, unsigned long ptr, unsigned long size, int site)
+{
+	if (table->nblocks * 2 >= table->blocks_cap)
+	{
+		struct alloc_block *old = table->blocks;
+		size_t old_cap = table->blocks_cap;
+		table->blocks_cap = old_cap ? old_cap * 2 : 1024;
+		table->blocks = calloc(table->blocks_cap, sizeof(struct alloc_block));
+		table->nblocks = 0;
+		for (size_t i = 0; i < old_cap; i++)
+		{
+			if (old[i].ptr != 0)
+				alloc_insert(table, old[i].ptr, old[i].size, old[i].site);
+		}
+		free(old);
+	}
+	// ptr isn't in the table, alloc_on_event took it out if it was live
+	size_t slot = alloc_hash(ptr, table->blocks_cap);
+	while (table->blocks[slot].ptr != 0)
+		slot = (slot + 1) & (table->blocks_cap - 1);
+	table->nblocks++;
+	table->blocks[slot].ptr = ptr;
+	table->blocks[slot].size = size;
+	table->blocks[slot].site = site;
+}
+
+// Take ptr out of the table, false if it isn't there
+bool alloc_remove(struct alloc_table *table, unsigned long ptr, struct alloc_block *block)
+{
+	if (table->blocks_cap == 0)
+		return false;
+	size_t mask = table->blocks_cap - 1;
+	size_t slot = alloc_hash(ptr, table->blocks_cap);
+	while (table->blocks[slot].ptr != ptr)
+	{
+		if (table->blocks[slot].ptr == 0)
+			return false;
+		slot = (slot + 1) & mask;
+	}
+	*block = table->blocks[slot];
+	// shift the following entries back so probes don't need tombstones
+	size_t hole = slot;
+	for (size_t next = (slot + 1) & mask; table->blocks[next].ptr != 0; next = (next + 1) & mask)
+	{
+		size_t home = alloc_hash(table->blocks[next].ptr, table->blocks_cap);
+		if (((next - home) & mask) >= ((next - hole) & mask))
+		{
+			table->blocks[hole] = table->blocks[next];
+			hole = next;
+		}
+	}
+	table->blocks[hole].ptr = 0;
+	table->nblocks--;
+	return true;
+}
+
+// Take a block out of the live bytes
+void alloc_release(struct alloc_table *table, const struct alloc_block *block)
+{
+	table->live_bytes -= block->size;
+	table->sites[block->site].live_blocks--;
+	table->sites[block->site].live_bytes -= block->size;
+}
+
+void alloc_free(struct alloc_table *table, unsigned long ptr)
+{
+	struct alloc_block block;
+	if (!alloc_remove(table, ptr, &block))
+	{
+		table->unknown_frees++;
+		return;
+	}
+	alloc_release(table, &block);
+}
+
+void alloc_on_event(void *arg, const struct audit_event *e)
+{
+	struct alloc_table *table = arg;
+	table->calls[e->func]++;
+	if (e->func == AUDIT_FREE)
+	{
+		alloc_free(table, e->ptr);
+		return;
+	}
+	// realloc(p, 0) frees p, and a failed realloc leaves it alone
+	if (e->func == AUDIT_REALLOC && e->old_ptr != 0 && (e->ptr != 0 || e->size == 0))
+		alloc_free(table, e->old_ptr);
+	if (e->ptr == 0)
+		return;
+	// a live block returned again was freed without going through the PLT
+	struct alloc_block old;
+	if (alloc_remove(table, e->ptr, &old))
+	{
+		alloc_release(table, &old);
+		table->missed_frees++;
+	}
+
+	int site = alloc_site_index(table, e->site);
+	struct alloc_site *s = &table->sites[site];
+	s->calls++;
+	s->bytes += e->size;
+	s->live_blocks++;
+	s->live_bytes += e->size;
+	table->bytes += e->size;
+	table->live_bytes += e->size;
+	if (table->live_bytes > table->peak_bytes)
+		table->peak_bytes = table->live_bytes;
+	alloc_insert(table, e->ptr, e->size, site);
+}
+
+int alloc_site_cmp(const void *a, const void *b)
+{
+	unsigned long bytes_a = ((const struct alloc_site *)a)->bytes;
+	unsigned long bytes_b = ((const struct alloc_site *)b)->bytes;
+	return bytes_a > bytes_b ? -1 : bytes_a < bytes_b;
+}
+
+#define ALLOC_TOP_SITES 20
+
+// Run the target with the LD_AUDIT library queueing its malloc, calloc,
+// realloc and free calls through the PLT, and keep its live heap in a table
+// while it runs. Reports the bytes allocated per call site, the peak of live
+// bytes and the blocks left allocated at exit.
+int alloc_profile(char *const target_args[], const char *audit_lib)
+{
+	char *exe_file_name = target_args[0];
+	char shm_name[64], lib_path[PATH_MAX];
+	struct audit_shared *shared = audit_open("alloc", audit_lib, shm_name, sizeof(shm_name), lib_path);
+	if (shared == NULL)
+		return -1;
+	static const char *alloc_funcs[AUDIT_NALLOC_FUNCS] = {
+		[AUDIT_MALLOC] = "malloc", [AUDIT_CALLOC] = "calloc", [AUDIT_REALLOC] = "realloc", [AUDIT_FREE] = "free"};
+	for (int i = 0; i < AUDIT_NALLOC_FUNCS; i++)
+		strcpy(shared->funcs[i].name, alloc_funcs[i]);
+	shared->nfuncs = AUDIT_NALLOC_FUNCS;
+	shared->alloc = 1;
+
+	pid_t pid = audit_run_target(target_args, lib_path, shm_name);
+	struct alloc_table table = {0};
+	unsigned long lost = audit_wait_target(shared, pid, alloc_on_event, &table);
+
+	long allocs = table.calls[AUDIT_MALLOC] + table.calls[AUDIT_CALLOC] + table.calls[AUDIT_REALLOC];
+	prf_printf("%s: %ld allocations (%ld malloc, %ld calloc, %ld realloc), %ld frees, %lu bytes, peak %lu bytes live\n",
+			   exe_file_name, allocs, table.calls[AUDIT_MALLOC], table.calls[AUDIT_CALLOC], table.calls[AUDIT_REALLOC],
+			   table.calls[AUDIT_FREE], table.bytes, table.peak_bytes);
+	prf_printf("%zu blocks (%lu bytes) leaked, %ld frees of blocks allocated elsewhere, %ld blocks allocated again "
+			   "without their free\n",
+			   table.nblocks, table.live_bytes, table.unknown_frees, table.missed_frees);
+	if (lost > 0)
+		prf_printf("%lu allocator calls were lost, the ring was full or a process left it\n", lost);
+
+	qsort(table.sites, table.nsites, sizeof(struct alloc_site), alloc_site_cmp);
+	const struct unwind_info *info = get_unwind_info(exe_file_name);
+	for (int i = 0; i < table.nsites && i < ALLOC_TOP_SITES; i++)
+	{
+		struct alloc_site *site = &table.sites[i];
+		const struct stack_func *func = unwind_find_func(info, site->addr);
+		char name[256];
+		if (func != NULL)
+			snprintf(name, sizeof(name), "%s+0x%lx", func->name, site->addr - func->addr);
+		else
+			snprintf(name, sizeof(name), "0x%lx", site->addr);
+		prf_printf("  %s: %ld allocations, %lu bytes, %ld leaked (%lu bytes)\n", name, site->calls, site->bytes,
+				   site->live_blocks, site->live_bytes);
+	}
+	if (table.nsites > ALLOC_TOP_SITES)
+		prf_printf("  %d more call sites\n", table.nsites - ALLOC_TOP_SITES);
+
+	free(table.blocks);
+	free(table.sites);
+	free(table.site_slots);
+	audit_close(shared, shm_name);
+	return pid < 0 ? -1 : 0;
+}
+
+// libprf_audit.so next to the prf executable
+const char *default_audit_lib(void)
+{
+	static char path[PATH_MAX];
+	ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - 1);
+	if (len < 0)
+		return "libprf_audit.so";
+	path[len] = '\0';
+	char *slash = strrchr(path, '/');
+	strcpy(slash ? slash + 1 : path, "libprf_audit.so");
+	return path;
+}
+
+// Offline lookup of symbol_name in any ELF file (32 or 64-bit, either byte
+// order, any type), from .symtab and else .dynsym
+int offline_lookup(const char *symbol_name, const char *file_name)
+{
+	struct symbol_index *index = get_symbol_index(file_name);
+	if (index == NULL || index->elf_class == 0)
+	{
+		prf_printf("%s is not an ELF file! :(\n", file_name);
+		return -1;
+	}
+	if (index->symtab_count == 0 && index->dynsym_count == 0)
+	{
+		prf_printf("%s has no symbol tables\n", file_name);
+		return -1;
+	}
+
+	const Elf64_Sym *found = NULL;
+	for (size_t i = 0; i < index->symtab_count && (found == NULL || ELF64_ST_BIND(found->st_info) != STB_GLOBAL); i++)
+	{
+		if (strcmp(index->strtab + index->symtab[i].st_name, symbol_name) == 0)
+			found = &index->symtab[i];
+	}
+	for (size_t i = 0; i < index->dynsym_count && found == NULL; i++)
+	{
+		if (strcmp(index->dynstr + index->dynsym[i].st_name, symbol_name) == 0)
+			found = &index->dynsym[i];
+	}
+	if (found == NULL)
+	{
+		prf_printf("%s not found!\n", symbol_name);
+		return -1;
+	}
+
+	prf_printf("%s is at 0x%lx, size %lu, %s%s in %s (ELF%d %s-endian)\n", symbol_name, found->st_value, found->st_size,
+			   ELF64_ST_BIND(found->st_info) == STB_GLOBAL ? "global" : "local",
+			   found->st_shndx == SHN_UNDEF ? " undefined" : "", file_name,
+			   index->elf_class == ELFCLASS32 ? 32 : 64, index->elf_data == ELFDATA2MSB ? "big" : "little");
+	return 0;
+}
+
+void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [options] <symbol> <executable> [args...]\n"
+					"       %s --coverage[=<file>] <executable> [args...]\n"
+					"       %s --alloc[=<lib>] <executable> [args...]\n", prog, prog, prog);
+	fprintf(stderr, "  --fork-server       start the target once and fork it for every line of\n"
+					"                      arguments read from the control fd\n"
+					"  --stop-at <symbol>  where the fork-server template stops (default: main)\n"
+					"  --control-fd <fd>   fork-server control pipe (default: 0)\n"
+					"  --jobs <n>          trace n copies of the target at once\n"
+					"  --attach <pid>      trace a running process, may be repeated; the\n"
+					"                      executable argument is then optional\n"
+					"  --threads <n>       shard the targets over n tracer threads\n"
+					"  --follow            also trace forked children and exec'd programs\n"
+					"  --coverage[=<file>] write a bitmap of the functions that ran, in .symtab\n"
+					"                      order, to file (default: prf.cov)\n"
+					"  --hw <symbols>      comma separated functions whose entry breakpoints go\n"
+					"                      in the debug registers (up to 4), the rest use int3\n"
+					"  --hw-auto           move the most hit entry breakpoints to the debug\n"
+					"                      registers once the trace warmed up\n"
+					"  --metrics <name>    keep live counters in the shared memory object\n"
+					"                      /prf-<name> and serve them as JSON on the unix\n"
+					"                      socket /tmp/prf-<name>.sock\n"
+					"  --lookup            only print where <symbol> is in <file>, which may be any\n"
+					"                      32 or 64-bit ELF file of either byte order\n"
+					"  --audit[=<lib>]     count imported functions in-process through LD_AUDIT\n"
+					"                      instead of ptrace (default: libprf_audit.so next to prf)\n"
+					"  --syscalls <list>   also count the comma separated syscalls (names or\n"
+					"                      numbers) with their errors and latency, stopping only\n"
+					"                      on these through a seccomp filter; implies --follow\n"
+					"  --stacks[=<file>]   write the call stack of every traced call as folded\n"
+					"                      stacks for flame graphs to file (default: prf.folded)\n"
+					"  --pin same|sibling  run the targets on the tracer's core, or on another\n"
+					"                      hardware thread of it\n"
+					"  --spin <us>         poll for stops this long before sleeping in waitpid\n"
+					"  --priority          run the tracer at SCHED_FIFO, or a lower nice value,\n"
+					"                      when permitted\n"
+					"  --where <expr>      only print (and export) the calls matching expr, a C\n"
+					"                      expression over arg0..arg5 and ret, the 64-bit registers\n"
+					"                      as longs (narrow ints with (int), e.g. \"(int)ret < 0\"),\n"
+					"                      tid, the traced thread (the process' main thread), and\n"
+					"                      depth, the other traced functions with a call in progress\n"
+					"  --counters          report on-cpu time, page faults and context switches\n"
+					"                      (and instructions and cycles where the host has them)\n"
+					"                      per call from perf counters of the traced threads,\n"
+					"                      less what prf's own stops inside the call cost\n"
+					"  --alloc[=<lib>]     profile malloc, calloc, realloc and free through LD_AUDIT:\n"
+					"                      bytes per call site, peak live bytes and leaked blocks\n"
+					"<symbol> may be a comma separated list, except in the default and fork-server modes.\n");
+}
+
+int main(int argc, char *const argv[])
+{
+	static const struct option long_options[] = {
+		{"fork-server", no_argument, NULL, 'F'},
+		{"stop-at", required_argument, NULL, 's'},
+		{"control-fd", required_argument, NULL, 'c'},
+		{"jobs", required_argument, NULL, 'j'},
+		{"attach", required_argument, NULL, 'p'},
+		{"threads", required_argument, NULL, 't'},
+		{"follow", no_argument, NULL, 'f'},
+		{"coverage", optional_argument, NULL, 'C'},
+		{"hw", required_argument, NULL, 'H'},
+		{"hw-auto", no_argument, NULL, 'A'},
+		{"metrics", required_argument, NULL, 'M'},
+		{"audit", optional_argument, NULL, 'L'},
+		{"lookup", no_argument, NULL, 'l'},
+		{"syscalls", required_argument, NULL, 'S'},
+		{"stacks", optional_argument, NULL, 'K'},
+		{"pin", required_argument, NULL, 'P'},
+		{"spin", required_argument, NULL, 'W'},
+		{"priority", no_argument, NULL, 'R'},
+		{"where", required_argument, NULL, 'w'},
+		{"counters", no_argument, NULL, 'k'},
+		{"alloc", optional_argument, NULL, 'a'},
+		{NULL, 0, NULL, 0},
+	};
+	static struct prf_options opts = {
+		.stop_symbol = "main",
+		.control_fd = STDIN_FILENO,
+		.nthreads = 1,
+	};
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "+", long_options, NULL)) != -1)
+	{
+		switch (opt)
+		{
+		case 'F':
+			opts.fork_server = true;
+			break;
+		case 's':
+			opts.stop_symbol = optarg;
+			break;
+		case 'c':
+			opts.control_fd = atoi(optarg);
+			break;
+		case 'j':
+			opts.jobs = atoi(optarg);
+			break;
+		case 'p':
+			if (opts.nattach < (int)(sizeof(opts.attach_pids) / sizeof(*opts.attach_pids)))
+				opts.attach_pids[opts.nattach++] = atoi(optarg);
+			break;
+		case 't':
+			opts.nthreads = atoi(optarg);
+			break;
+		case 'f':
+			opts.follow = true;
+			break;
+		case 'C':
+			opts.coverage_file = optarg ? optarg : "prf.cov";
+			break;
+		case 'H':
+			opts.hw_symbols = optarg;
+			break;
+		case 'A':
+			opts.hw_auto = true;
+			break;
+		case 'M':
+			opts.metrics_name = optarg;
+			break;
+		case 'L':
+			opts.audit_lib = optarg ? optarg : default_audit_lib();
+			break;
+		case 'l':
+			opts.lookup = true;
+			break;
+		case 'P':
+			if (strcmp(optarg, "same") == 0)
+				opts.pin = PIN_SAME;
+			else if (strcmp(optarg, "sibling") == 0)
+				opts.pin = PIN_SIBLING;
+			else
+			{
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'W':
+			opts.spin_us = atoi(optarg);
+			break;
+		case 'R':
+			opts.priority = true;
+			break;
+		case 'a':
+			opts.alloc_lib = optarg ? optarg : default_audit_lib();
+			break;
+		case 'k':
+			opts.counters = true;
+			break;
+		case 'w':
+		{
+			static struct predicate where;
+			if (predicate_compile(optarg, &where) < 0)
+				return 1;
+			opts.where = &where;
+			break;
+		}
+		case 'K':
+			opts.stacks_file = optarg ? optarg : "prf.folded";
+			break;
+		case 'S':
+			for (char *save = NULL, *name = strtok_r(optarg, ",", &save); name != NULL; name = strtok_r(NULL, ",", &save))
+			{
+				int nr = syscall_nr(name);
+				if (nr < 0)
+				{
+					prf_printf("unknown syscall %s\n", name);
+					return 1;
+				}
+				if (opts.nsyscalls < MAX_TRACED_SYSCALLS)
+					opts.syscalls[opts.nsyscalls++] = nr;
+			}
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+	// the modes run their own loop, so they take none of the engine's options
+	// and exclude each other; --where applies to the default mode too
+	bool engine = opts.jobs > 0 || opts.nattach > 0 || opts.nthreads != 1 || opts.follow || opts.hw_symbols != NULL ||
+				  opts.hw_auto || opts.metrics_name != NULL || opts.nsyscalls > 0 || opts.stacks_file != NULL ||
+				  opts.pin != PIN_NONE || opts.spin_us > 0 || opts.priority || opts.counters;
+	int modes = opts.fork_server + (opts.coverage_file != NULL) + (opts.alloc_lib != NULL) + opts.lookup +
+				(opts.audit_lib != NULL);
+	if (modes > 1 || (modes == 1 && engine) ||
+		(opts.where != NULL && modes == 1 && !opts.fork_server))
+	{
+		fprintf(stderr, "%s: --fork-server, --coverage, --alloc, --lookup and --audit can't be combined with each\n"
+						"other or with the multi-process options, nor (except --fork-server) with --where\n",
+				argv[0]);
+		usage(argv[0]);
+		return 1;
+	}
+	if (opts.coverage_file != NULL && argc - optind >= 1)
+		return coverage(argv + optind, opts.coverage_file) < 0 ? 1 : 0;
+	if (opts.alloc_lib != NULL && argc - optind >= 1)
+		return alloc_profile(argv + optind, opts.alloc_lib) < 0 ? 1 : 0;
+	if (argc - optind < (opts.jobs == 0 && opts.nattach > 0 ? 1 : 2))
+	{
+		usage(argv[0]);
+		return 1;
+	}
+	if (opts.lookup)
+		return offline_lookup(argv[optind], argv[optind + 1]) < 0 ? 1 : 0;
+	if (opts.audit_lib != NULL)
+		return audit_trace(argv[optind], argv + optind + 1, opts.audit_lib) < 0 ? 1 : 0;
+	// forked children inherit the seccomp filter, and untraced they'd get ENOSYS
+	// from its traced syscalls, so they are followed
+	if (opts.nsyscalls > 0)
+		opts.follow = true;
+	// the engine's options need it even for a single target, its only job
+	if (engine && opts.jobs == 0 && opts.nattach == 0)
+		opts.jobs = 1;
+	if (engine)
+		return multi_trace(argv[optind], argv + optind + 1, &opts) < 0 ? 1 : 0;
+
+	char *symbol_name = argv[optind];
+	char *exe_file_name = argv[optind + 1];
+
+	int err = 0;
+	unsigned long addr = find_symbol(symbol_name, exe_file_name, &err);
+	// printf("addr: %lx \n", addr);
+	if (err > 0)
+		// prf_printf("%s will be loaded to 0x%lx\n", symbol_name, addr);
+		(void)0;
+	else if (err == -2)
+		prf_printf("%s is not a global symbol! :(\n", symbol_name);
+	else if (err == -1)
+		prf_printf("%s not found!\n", symbol_name);
+	else if (err == -3)
+		prf_printf("%s not an executable! :(\n", exe_file_name);
+	else if (err == -4)
+		prf_printf("%s is a global symbol, but will come from a shared library with address %lx\n", symbol_name, addr);
+
+	if (opts.fork_server)
+	{
+		if (err <= 0)
+			return 1;
+		return fork_server(exe_file_name, addr, err == 2, opts.stop_symbol, opts.control_fd, opts.where) < 0 ? 1 : 0;
+	}
+
+	pid_t pid = run_target(exe_file_name, argv + optind + 1, NULL, 0);
+	if (pid < 0)
+	{
+		// printf("Error running target program\n");
+		perror("fork");
+		return -1;
+	}
+	if (pid > 0)
+	{
+		count_calls(addr, pid, err == 2, opts.where);
+	}
+	else
+	{
+		// printf("Error running target program\n");
+		perror("fork");
+		return -1;
+	}
+}
@@ -0,0 +1,197 @@
+// gcc -shared -fPIC -o libprf_audit.so prf_audit.c
+// LD_AUDIT library for prf --audit: counts calls to the selected imported
+// functions and queues their return values in shared memory, without ptrace.
+// For prf --alloc it queues the allocator calls instead.
+#define _GNU_SOURCE
+#include <link.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/mman.h>
+
+#include "prf_audit.h"
+
+// the rtld-audit hooks have a fixed signature, most of it isn't needed here
+#define UNUSED __attribute__((unused))
+
+static struct audit_shared *shared = NULL;
+// recursive calls through the PLT aren't reported, like with breakpoints
+static __thread int depth[AUDIT_MAX_FUNCS];
+
+// allocator calls between their la_pltenter and la_pltexit, per thread
+#define ALLOC_MAX_NESTED 8
+struct alloc_call
+{
+	int func;
+	unsigned long arg0;
+	unsigned long arg1;
+	unsigned long site;
+};
+static __thread struct alloc_call alloc_calls[ALLOC_MAX_NESTED];
+static __thread int nalloc_calls;
+
+static int audit_func_index(const char *symname)
+{
+	for (int i = 0; i < shared->nfuncs; i++)
+	{
+		if (strcmp(shared->funcs[i].name, symname) == 0)
+			return i;
+	}
+	return -1;
+}
+
+unsigned int la_version(unsigned int version)
+{
+	const char *shm_name = getenv(PRF_AUDIT_SHM_ENV);
+	if (shm_name == NULL)
+		return version;
+	int fd = shm_open(shm_name, O_RDWR, 0);
+	if (fd < 0)
+		return version;
+	void *addr = mmap(NULL, sizeof(struct audit_shared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr != MAP_FAILED)
+		shared = addr;
+	return version;
+}
+
+unsigned int la_objopen(UNUSED struct link_map *map, UNUSED Lmid_t lmid, UNUSED uintptr_t *cookie)
+{
+	return shared != NULL ? LA_FLG_BINDTO | LA_FLG_BINDFROM : 0;
+}
+
+// Only the selected symbols go through la_pltenter/la_pltexit, every other
+// binding keeps the plain PLT
+uintptr_t la_symbind64(Elf64_Sym *sym, UNUSED unsigned int ndx, UNUSED uintptr_t *refcook, UNUSED uintptr_t *defcook,
+					   unsigned int *flags, const char *symname)
+{
+	int func = audit_func_index(symname);
+	if (func < 0)
+		*flags |= LA_SYMB_NOPLTENTER | LA_SYMB_NOPLTEXIT;
+	else if (shared->alloc && func == AUDIT_FREE)
+		*flags |= LA_SYMB_NOPLTEXIT;
+	return sym->st_value;
+}
+
+static long elapsed_ns(const struct timespec *start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1000000000L + now.tv_nsec - start->tv_nsec;
+}
+
+// Queue a call for prf. A slot is only reserved once the ring has room, so a
+// call given up on leaves no hole for prf to wait on. While it's full this
+// waits for prf, but only up to AUDIT_RING_WAIT_NS: past that prf was killed,
+// and the calls of every process are dropped from then on.
+static void queue_event(int func, unsigned long ptr, unsigned long old_ptr, unsigned long size, unsigned long site)
+{
+	struct timespec start;
+	unsigned long n = __atomic_load_n(&shared->ring_head, __ATOMIC_RELAXED);
+	for (unsigned long spins = 0;; spins++)
+	{
+		if (__atomic_load_n(&shared->consumer_gone, __ATOMIC_ACQUIRE))
+		{
+			__atomic_fetch_add(&shared->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		if (n - __atomic_load_n(&shared->ring_tail, __ATOMIC_ACQUIRE) < AUDIT_RING)
+		{
+			// fails, with n updated, if another thread or process took it
+			if (__atomic_compare_exchange_n(&shared->ring_head, &n, n + 1, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+			continue;
+		}
+		if (spins == 0)
+			clock_gettime(CLOCK_MONOTONIC, &start);
+		else if ((spins & 255) == 0 && elapsed_ns(&start) > AUDIT_RING_WAIT_NS)
+			__atomic_store_n(&shared->consumer_gone, 1, __ATOMIC_RELEASE);
+		sched_yield();
+		n = __atomic_load_n(&shared->ring_head, __ATOMIC_RELAXED);
+	}
+	struct audit_event *e = &shared->ring[n & (AUDIT_RING - 1)];
+	e->func = func;
+	e->ptr = ptr;
+	e->old_ptr = old_ptr;
+	e->size = size;
+	e->site = site;
+	__atomic_store_n(&e->seq, n + 1, __ATOMIC_RELEASE);
+}
+
+// la_pltenter of an allocator function, its arguments wait for the return value
+static void alloc_enter(int func, const La_x86_64_regs *regs)
+{
+	// the PLT was called, the return address is on top of the stack
+	unsigned long site = *(unsigned long *)regs->lr_rsp;
+	if (func == AUDIT_FREE)
+	{
+		if (regs->lr_rdi != 0)
+			queue_event(func, regs->lr_rdi, 0, 0, site);
+		return;
+	}
+	if (nalloc_calls < ALLOC_MAX_NESTED)
+	{
+		struct alloc_call *call = &alloc_calls[nalloc_calls];
+		call->func = func;
+		call->arg0 = regs->lr_rdi;
+		call->arg1 = regs->lr_rsi;
+		call->site = site;
+	}
+	nalloc_calls++;
+}
+
+static void alloc_exit(unsigned long ret)
+{
+	if (nalloc_calls == 0 || --nalloc_calls >= ALLOC_MAX_NESTED)
+		return;
+	struct alloc_call *call = &alloc_calls[nalloc_calls];
+	if (call->func == AUDIT_MALLOC)
+		queue_event(call->func, ret, 0, call->arg0, call->site);
+	else if (call->func == AUDIT_CALLOC)
+		queue_event(call->func, ret, 0, call->arg0 * call->arg1, call->site);
+	else if (call->func == AUDIT_REALLOC)
+		queue_event(call->func, ret, call->arg0, call->arg1, call->site);
+}
+
+Elf64_Addr la_x86_64_gnu_pltenter(Elf64_Sym *sym, UNUSED unsigned int ndx, UNUSED uintptr_t *refcook,
+								  UNUSED uintptr_t *defcook, La_x86_64_regs *regs, UNUSED unsigned int *flags,
+								  const char *symname, long int *framesizep)
+{
+	int func = audit_func_index(symname);
+	if (shared->alloc)
+	{
+		if (func >= 0)
+			alloc_enter(func, regs);
+		if (func != AUDIT_FREE)
+			*framesizep = 128;
+		return sym->st_value;
+	}
+	if (func >= 0)
+		depth[func]++;
+	// la_pltexit is only called with a frame size, cover any stack arguments
+	*framesizep = 128;
+	return sym->st_value;
+}
+
+unsigned int la_x86_64_gnu_pltexit(UNUSED Elf64_Sym *sym, UNUSED unsigned int ndx, UNUSED uintptr_t *refcook,
+								   UNUSED uintptr_t *defcook, UNUSED const La_x86_64_regs *inregs,
+								   La_x86_64_retval *outregs, const char *symname)
+{
+	int func = audit_func_index(symname);
+	if (shared->alloc)
+	{
+		if (func >= 0)
+			alloc_exit(outregs->lrv_rax);
+		return 0;
+	}
+	if (func < 0 || --depth[func] > 0)
+		return 0;
+
+	__atomic_fetch_add(&shared->funcs[func].calls, 1, __ATOMIC_RELAXED);
+	queue_event(func, outregs->lrv_rax, 0, 0, 0);
+	return 0;
+}
@@ -0,0 +1,54 @@
+#ifndef _PRF_AUDIT_H_
+#define _PRF_AUDIT_H_ 1
+
+/*
+ * Shared memory between prf and the LD_AUDIT library it loads into the
+ * target (prf_audit.c), used by prf --audit and prf --alloc.
+ */
+
+#define PRF_AUDIT_SHM_ENV "PRF_AUDIT_SHM"	/* name of the shared memory object */
+
+#define AUDIT_MAX_FUNCS 16
+
+struct audit_func {
+	char	name[64];	/* Symbol, filled in by prf. */
+	long	calls;		/* Outermost calls that returned. */
+};
+
+/*
+ * prf --alloc: funcs holds these allocator functions, in this order.
+ */
+#define AUDIT_MALLOC	0
+#define AUDIT_CALLOC	1
+#define AUDIT_REALLOC	2
+#define AUDIT_FREE	3
+#define AUDIT_NALLOC_FUNCS 4
+
+/*
+ * The calls are queued in ring for prf to drain while the target runs: the
+ * outermost returns of funcs for prf --audit, the allocator calls for --alloc.
+ */
+#define AUDIT_RING (1 << 16)		/* Must be a power of 2. */
+#define AUDIT_RING_WAIT_NS 1000000000L	/* For prf to drain a full ring. */
+
+struct audit_event {
+	unsigned long	seq;		/* Ring position + 1, set last. */
+	int		func;		/* Index in funcs, AUDIT_MALLOC... */
+	unsigned long	ptr;		/* Return value, or block returned or freed. */
+	unsigned long	old_ptr;	/* Block passed to realloc. */
+	unsigned long	size;
+	unsigned long	site;		/* Return address of the call. */
+};
+
+struct audit_shared {
+	int			nfuncs;
+	struct audit_func	funcs[AUDIT_MAX_FUNCS];
+	int			alloc;		/* Queue allocator calls instead. */
+	unsigned long		ring_head;	/* Events reserved by the target. */
+	unsigned long		ring_tail;	/* Events consumed by prf. */
+	int			consumer_gone;	/* Set once prf stops draining. */
+	unsigned long		dropped;	/* Events not queued since. */
+	struct audit_event	ring[AUDIT_RING];
+};
+
+#endif /* !_PRF_AUDIT_H_ */
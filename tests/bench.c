@@ -0,0 +1,26 @@
+#include <stdlib.h>
+// gcc -no-pie -O0 -o bench.out bench.c
+// Calls bench_func argv[1] times, the tracer pays one breakpoint round trip per call.
+
+int bench_func(int x)
+{
+    return x + 1;
+}
+
+int other_func(int x)
+{
+    return x - 1;
+}
+
+int main(int argc, char *argv[])
+{
+    long calls = argc > 1 ? atol(argv[1]) : 100000;
+    int sum = 0;
+    for (long i = 0; i < calls; i++)
+    {
+        sum = bench_func(sum);
+        if (i % 64 == 0)
+            sum = other_func(sum);
+    }
+    return sum & 1;
+}
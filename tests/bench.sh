@@ -0,0 +1,51 @@
+# Per-call cost of the tracer for each breakpoint implementation.
+# Copy prf into this folder first, like for unit.sh. Usage: ./bench.sh [calls]
+
+gcc -no-pie -O0 -o bench.out bench.c
+CALLS=${1:-100000}
+
+run()
+{
+    START=$(date +%s%N)
+    ./prf "$@" bench_func,other_func ./bench.out $CALLS > /dev/null
+    END=$(date +%s%N)
+    echo "$*: $(( (END - START) / CALLS )) ns/call"
+}
+
+run --jobs 1
+run --hw bench_func
+run --hw bench_func,other_func
+run --hw-auto
+
+# stop latency for each tracer scheduling option, as measured by prf per target
+echo "handling: waitpid return to the resume of the target, single steps left out"
+echo "steps: single step round trips over a breakpoint, made during a stop"
+echo "running: the target's resume to its own next stop, its code in between included"
+sched()
+{
+    echo "$*: $(./prf "$@" bench_func ./bench.out $CALLS | grep -o '[0-9]* ns handling.*')"
+}
+
+sched --jobs 1
+sched --pin same
+sched --pin sibling
+sched --spin 20
+sched --pin sibling --spin 20
+sched --priority
+sched --pin sibling --spin 20 --priority
+
+# symbol resolution through the native ELF reader, prf startup included
+START=$(date +%s%N)
+for i in $(seq 200); do
+    ./prf --lookup bench_func ./bench.out > /dev/null
+done
+END=$(date +%s%N)
+echo "--lookup: $(( (END - START) / 200000 )) us/lookup"
+
+# loading the symbol tables alone, without the startup that hides it above, of
+# bench.out and of an executable with 50000 functions
+gcc -O2 -o lookup_bench.out lookup_bench.c -lpthread
+seq 50000 | awk '{ print "int f" $1 "(int x) { return x + " $1 "; }" } END { print "int main(void) { return f1(0); }" }' > big.c
+gcc -no-pie -O0 -o big.out big.c
+./lookup_bench.out ./bench.out 5000
+./lookup_bench.out ./big.out 300
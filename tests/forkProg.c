@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+// gcc -no-pie -o forkProg.out forkProg.c
+// Forks a child that execs this program again, then a vfork child that execs
+// myProg.out, calling work in every process along the way, and prints how the
+// children exited.
+int work(int x)
+{
+    return x * 2;
+}
+
+static void reap(const char *name, pid_t pid)
+{
+    int status;
+    waitpid(pid, &status, 0);
+    printf("%s child %s\n", name, WIFEXITED(status) ? "exited" : "was killed");
+}
+
+int main(int argc, char *argv[])
+{
+    (void)argv;
+    if (argc > 1)
+    {
+        work(10);
+        return 0;
+    }
+    char *const again[] = {"./forkProg.out", "again", NULL};
+    char *const other[] = {"./myProg.out", NULL};
+    work(1);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        work(2);
+        execv(again[0], again);
+        _exit(1);
+    }
+    reap("fork", pid);
+    pid = vfork();
+    if (pid == 0)
+    {
+        work(4);
+        execv(other[0], other);
+        _exit(1);
+    }
+    reap("vfork", pid);
+    work(5);
+    return 0;
+}
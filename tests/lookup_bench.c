@@ -0,0 +1,32 @@
+// gcc -O2 -o lookup_bench.out lookup_bench.c -lpthread
+// Time of loading the symbol tables of an ELF file and looking up a missing
+// symbol in them, inside prf's own code, without its process startup. Build
+// with -DPRF_SOURCE='"<file>"' to measure another version of prf.
+#ifndef PRF_SOURCE
+#define PRF_SOURCE "../hw3_part1.c"
+#endif
+#define main prf_main
+#include PRF_SOURCE
+#undef main
+
+int main(int argc, char *argv[])
+{
+    int runs = argc > 2 ? atoi(argv[2]) : 1000;
+    double total_us = 0, best_us = 0;
+    for (int i = 0; i < runs; i++)
+    {
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        // a fresh load every time, the cache of get_symbol_index is bypassed
+        struct symbol_index *index = load_symbol_index(argv[1]);
+        int err = 0;
+        symbol_index_lookup(index, "no_such_symbol", &err);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double us = (end.tv_sec - start.tv_sec) * 1e6 + (end.tv_nsec - start.tv_nsec) / 1e3;
+        total_us += us;
+        if (i == 0 || us < best_us)
+            best_us = us;
+    }
+    printf("%s: %.1f us mean, %.1f us best\n", argv[1], total_us / runs, best_us);
+    return 0;
+}
@@ -39,6 +39,10 @@ static bool CompareTwoFiles(const char*f1, const char*f2);
 */                         
 /*************************************************************************/
 static const std::string G_app = "./prf";
+// masks the timings, which change from run to run
+static const std::string G_noTimes = " | sed -E 's/[0-9.]+ (us|s|runs\\/sec)/N \\1/g'";
+// masks the pids and the folder, and drops the tracer's own figures
+static const std::string G_noPids = " | grep -v 'stops,\\|tracer cpu' | sed -E \"s|$PWD/||; s/:: ( *)[0-9]+ /:: \\1PID /\"";
 
 #define EXECUTABLE_PERMISSIONS \
     (S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP |S_IROTH |S_IXOTH |S_IXUSR | S_IXGRP )
@@ -126,6 +130,98 @@ static bool testSeven(void)
     return true;
 }
 
+// lookup32.o is mySharedLib.c built with gcc -m32 -c, lookup32be.o and
+// lookup64be.o are it and its x86-64 build with the byte order swapped,
+// nosections.core is a bare ELF header with no sections like a core dump
+static bool testEight(void)
+{
+    const char* progName = "myProg.out";
+    system((G_app + " --lookup foo " + progName + " > t8_actual.txt").c_str());
+    system((G_app + " --lookup funcWillBeLoadedInRunTime2 " + progName + " >> t8_actual.txt").c_str());
+    system((G_app + " --lookup fooNotExist " + progName + " >> t8_actual.txt").c_str());
+    system((G_app + " --lookup funcWillBeLoadedInRunTimeRecursice lookup32.o >> t8_actual.txt").c_str());
+    system((G_app + " --lookup funcWillBeLoadedInRunTimeRecursice lookup32be.o >> t8_actual.txt").c_str());
+    system((G_app + " --lookup funcWillBeLoadedInRunTimeRecursice lookup64be.o >> t8_actual.txt").c_str());
+    system((G_app + " --lookup foo nosections.core >> t8_actual.txt").c_str());
+    system((G_app + " --lookup foo mySharedLib.c >> t8_actual.txt").c_str());
+    ASSERT_TEST(CompareTwoFiles("t8_expec.txt", "t8_actual.txt"));
+    return true;
+}
+
+static bool testNine(void)
+{
+    const char* progName = "myProg.out";
+    system((G_app + " --where 'ret > 0' foo " + progName + " > t9_actual.txt").c_str());
+    system((G_app + " --where 'arg0 == 42 && ret > 0' foo " + progName + " >> t9_actual.txt").c_str());
+    system((G_app + " --where '!(ret == 0) || depth > 0' foo " + progName + " >> t9_actual.txt").c_str());
+    system((G_app + " --where 'ret <' foo " + progName + " >> t9_actual.txt").c_str());
+    system((G_app + " --where 'retval > 1' foo " + progName + " >> t9_actual.txt").c_str());
+    system((G_app + " --where 'ret > 0)' foo " + progName + " >> t9_actual.txt").c_str());
+    system((G_app + " --where '(ret > 0' foo " + progName + " >> t9_actual.txt").c_str());
+    ASSERT_TEST(CompareTwoFiles("t9_expec.txt", "t9_actual.txt"));
+    return true;
+}
+
+static bool testTen(void)
+{
+    const char* progName = "myProg.out";
+    system((G_app + " --audit funcWillBeLoadedInRunTime2 " + progName + " > t10_actual.txt").c_str());
+    system((G_app + " --audit funcWillBeLoadedInRunTimeRecursice " + progName + " >> t10_actual.txt").c_str());
+    system((G_app + " --audit funcWillBeLoadedInRunTime2,funcWillBeLoadedInRunTimeRecursice " + progName + " >> t10_actual.txt").c_str());
+    ASSERT_TEST(CompareTwoFiles("t10_expec.txt", "t10_actual.txt"));
+    return true;
+}
+
+static bool testEleven(void)
+{
+    const char* progName = "myProg.out";
+    system(("printf '\\nprintme\\n\\n' | " + G_app + " --fork-server fooIntrisic " + progName + G_noTimes + " > t11_actual.txt").c_str());
+    system(("printf 'printme\\n\\n' | " + G_app + " --fork-server --stop-at foo foo " + progName + G_noTimes + " >> t11_actual.txt").c_str());
+    system(("printf '\\n' | " + G_app + " --fork-server --stop-at fooNotExist foo " + progName + G_noTimes + " >> t11_actual.txt").c_str());
+    ASSERT_TEST(CompareTwoFiles("t11_expec.txt", "t11_actual.txt"));
+    return true;
+}
+
+static bool testTwelve(void)
+{
+    const char* progName = "myProg.out";
+    system((G_app + " --coverage=t12.cov " + progName + G_noTimes + " > t12_actual.txt").c_str());
+    system("od -An -tx1 t12.cov >> t12_actual.txt");
+    system((G_app + " --coverage=t12.cov " + progName + " printme" + G_noTimes + " >> t12_actual.txt").c_str());
+    system("od -An -tx1 t12.cov >> t12_actual.txt");
+    ASSERT_TEST(CompareTwoFiles("t12_expec.txt", "t12_actual.txt"));
+    return true;
+}
+
+static bool testThirteen(void)
+{
+    const char* progName = "./forkProg.out";
+    system((G_app + " work " + progName + " > t13_actual.txt").c_str());
+    system((G_app + " --follow work,foo " + progName + G_noPids + " >> t13_actual.txt").c_str());
+    ASSERT_TEST(CompareTwoFiles("t13_expec.txt", "t13_actual.txt"));
+    return true;
+}
+
+static bool testFourteen(void)
+{
+    const char* progName = "./forkProg.out";
+    system((G_app + " --syscalls vfork,wait4,exit_group,write work " + progName + G_noPids + G_noTimes + " > t14_actual.txt").c_str());
+    ASSERT_TEST(CompareTwoFiles("t14_expec.txt", "t14_actual.txt"));
+    return true;
+}
+
+static bool testFifteen(void)
+{
+    const char* progName = "myProg.out";
+    const std::string funcs = " RecursionFunc,foo,funcWillBeLoadedInRunTime2 ";
+    // the same counts with debug registers as with int3
+    system((G_app + " --jobs 1" + funcs + progName + G_noPids + " > t15_actual.txt").c_str());
+    system((G_app + " --jobs 1 --hw RecursionFunc,foo,funcWillBeLoadedInRunTime2" + funcs + progName + G_noPids + " >> t15_actual.txt").c_str());
+    system((G_app + " --jobs 1 --hw foo" + funcs + progName + G_noPids + " >> t15_actual.txt").c_str());
+    ASSERT_TEST(CompareTwoFiles("t15_expec.txt", "t15_actual.txt"));
+    return true;
+}
+
 
 /*************************************************************************/
 /*
@@ -212,6 +308,14 @@ bool (*tests[]) (void) = {
         testFive,
         testSix,
         testSeven,
+        testEight,
+        testNine,
+        testTen,
+        testEleven,
+        testTwelve,
+        testThirteen,
+        testFourteen,
+        testFifteen,
 };
 
 #define NUMBER_TESTS ((long)(sizeof(tests)/sizeof(*tests)))
@@ -226,6 +330,14 @@ const char* testNames[NUMBER_TESTS] = {
         "test recursive function",
         "test dynamic function",
         "test intrisic",
+        "test lookup in other ELF classes",
+        "test --where filter and its errors",
+        "test --audit returns of one and several functions",
+        "test fork-server runs and --stop-at",
+        "test function coverage bitmap",
+        "test --follow process tree and vfork children",
+        "test --syscalls counts, exit_group included",
+        "test --hw counts equal the int3 counts",
 };
 
 